@@ -7,7 +7,10 @@
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+//   breadahead reads consecutive blocks ahead of use, and
+//   bgetz skips the read for a block about to be overwritten.
 // * After changing buffer data, call bwrite to write it to disk.
+//   brwv reads or writes a batch of buffers, merging adjacent blocks.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -22,6 +25,10 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "blkdev.h"
+
+// the root disk's driver, set by its init function.
+struct blkdev *bdev;
 
 struct {
   struct spinlock lock;
@@ -96,19 +103,82 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    bdev->rw(&b, 1, 0, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, zeroed rather
+// than read from disk, for a caller that will overwrite it.
+struct buf*
+bgetz(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+// Read blocks blockno..blockno+n-1 into the cache ahead of
+// use, merging them into as few disk requests as possible.
+// Blocks already cached are skipped.
+void
+breadahead(uint dev, uint blockno, int n)
+{
+  struct buf *b[MAXIOBLOCKS];
+  int i, j, m;
+
+  for(i = 0; i < n; ){
+    for(m = 0; m < MAXIOBLOCKS && i < n; i++){
+      b[m] = bget(dev, blockno + i);
+      if(b[m]->valid)
+        brelse(b[m]);
+      else
+        m++;
+    }
+    if(m == 0)
+      continue;
+    bdev->rw(b, m, 0, 0);
+    for(j = 0; j < m; j++){
+      b[j]->valid = 1;
+      brelse(b[j]);
+    }
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bdev->rw(&b, 1, 1, 0);
+}
+
+// Read or write the contents of n locked bufs.
+// Adjacent blocks are merged into single disk requests,
+// so callers should batch I/O to consecutive blocks.
+// The bufs needn't be in the cache; the log uses this
+// for its private staging buffers.
+// sync marks the I/O as latency sensitive, e.g. a log
+// commit, which may then poll for completion.
+void
+brwv(struct buf **bufs, int n, int write, int sync)
+{
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > MAXIOBLOCKS)
+      m = MAXIOBLOCKS;
+    for(int j = i; j < i+m; j++)
+      if(!holdingsleep(&bufs[j]->lock))
+        panic("brwv");
+    bdev->rw(bufs+i, m, write, sync);
+  }
 }
 
 // Release a locked buffer.
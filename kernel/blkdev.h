@@ -0,0 +1,15 @@
+// Block device interface, used by the buffer cache.
+// Exactly one backend is the root disk; which one is
+// chosen at build time (make RAMDISK=1 for the ramdisk).
+struct blkdev {
+  char *name;
+  // read or write n (<= MAXIOBLOCKS) locked bufs and wait
+  // for them; sync marks latency-sensitive writes.
+  void (*rw)(struct buf **bufs, int n, int write, int sync);
+  void (*stat)(struct diskstat *st);
+  int (*mode)(int mode);  // set completion mode; 0 if none
+};
+
+extern struct blkdev *bdev;
+extern struct blkdev virtio_blkdev;
+extern struct blkdev ramdisk_blkdev;
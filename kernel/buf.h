@@ -5,6 +5,7 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
+  int logged;  // pinned by the log until installed at its home location?
   struct buf *prev; // LRU cache list
   struct buf *next;
   uchar data[BSIZE];
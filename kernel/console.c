@@ -21,6 +21,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "waitq.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,13 +53,16 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct waitq rq;  // poll()s waiting for input
 } cons;
 
 //
 // user write()s to the console go here.
+// with O_NONBLOCK, stop when the uart's
+// output buffer is full.
 //
 int
-consolewrite(int user_src, uint64 src, int n)
+consolewrite(int user_src, uint64 src, int n, int flags)
 {
   int i;
 
@@ -65,10 +71,17 @@ consolewrite(int user_src, uint64 src, int n)
     char c;
     if(either_copyin(&c, user_src, src+i, 1) == -1)
       break;
-    uartputc(c);
+    if(flags & O_NONBLOCK){
+      if(!uarttryputc(c))
+        break;
+    } else {
+      uartputc(c);
+    }
   }
   release(&cons.lock);
 
+  if(i == 0 && n > 0 && (flags & O_NONBLOCK))
+    return -EAGAIN;
   return i;
 }
 
@@ -76,10 +89,11 @@ consolewrite(int user_src, uint64 src, int n)
 // user read()s from the console go here.
 // copy (up to) a whole input line to dst.
 // user_dist indicates whether dst is a user
-// or kernel address.
+// or kernel address. with O_NONBLOCK, return
+// -EAGAIN rather than wait for a line.
 //
 int
-consoleread(int user_dst, uint64 dst, int n)
+consoleread(int user_dst, uint64 dst, int n, int flags)
 {
   uint target;
   int c;
@@ -95,6 +109,10 @@ consoleread(int user_dst, uint64 dst, int n)
         release(&cons.lock);
         return -1;
       }
+      if(flags & O_NONBLOCK){
+        release(&cons.lock);
+        return n < target ? target - n : -EAGAIN;
+      }
       sleep(&cons.r, &cons.lock);
     }
 
@@ -128,6 +146,28 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: readable once a line (or
+// end-of-file) has arrived; writable while the uart's
+// output buffer has room.
+//
+int
+consolepoll(int events, struct polltable *t)
+{
+  int r;
+
+  r = 0;
+  acquire(&cons.lock);
+  if((events & POLLIN) && cons.r != cons.w)
+    r |= POLLIN;
+  if((events & POLLOUT) && uartpoll(r ? 0 : t))
+    r |= POLLOUT;
+  if((events & POLLIN) && !r)
+    pollwait(&cons.rq, &cons.lock, t);
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -172,6 +212,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwake(&cons.rq);
       }
     }
     break;
@@ -191,4 +232,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
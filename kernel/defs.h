@@ -1,8 +1,13 @@
 struct buf;
 struct context;
+struct diskstat;
 struct file;
 struct inode;
 struct pipe;
+struct pipestat;
+struct polltable;
+struct waitq;
+struct iovec;
 struct proc;
 struct spinlock;
 struct sleeplock;
@@ -14,6 +19,9 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            brwv(struct buf**, int, int, int);
+void            breadahead(uint, uint, int);
+struct buf*     bgetz(uint, uint);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -31,14 +39,21 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
+int             fileiread(struct file*, int, uint64, int);
+int             fileiwrite(struct file*, int, uint64, int);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filecopy(struct file*, struct file*, int);
+int             filepoll(struct file*, int, struct polltable*);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
@@ -53,11 +68,11 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             writeicost(uint);
+int             copyi(struct inode*, uint, struct inode*, uint, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
@@ -69,12 +84,30 @@ void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+void            log_sync(void);
+void            log_stat(struct diskstat*);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipereadv(struct pipe*, struct iovec*, int, int);
+int             pipewritev(struct pipe*, struct iovec*, int, int);
+int             pipefcntl(struct pipe*, int, int);
+int             pipesplice(struct file*, struct file*, int, int);
+int             pipevmsplice(struct pipe*, uint64, int);
+void            pipestats(struct pipestat*);
+int             pipepoll(struct pipe*, int, struct polltable*);
+
+// poll.c
+int             poll(uint64, int, int);
+void            pollwait(struct waitq*, struct spinlock*, struct polltable*);
+void            pollwake(struct waitq*);
+void            polltick(void);
 
 // printf.c
 void            printf(char*, ...);
@@ -104,6 +137,7 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(char*, void (*)(void));
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -138,6 +172,7 @@ int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+extern uint64   nsyscall;
 
 // trap.c
 extern uint     ticks;
@@ -150,6 +185,8 @@ void            usertrapret(void);
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+int             uarttryputc(int);
+int             uartpoll(struct polltable*);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -167,6 +204,7 @@ int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+uint64          uvmremap(pagetable_t, uint64, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -180,7 +218,6 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
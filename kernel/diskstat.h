@@ -0,0 +1,35 @@
+// Disk request statistics, reported by the diskstat() system call.
+
+#define DISK_NLAT 24 // latency histogram buckets
+
+struct diskstat {
+  uint64 nreq;     // disk requests issued to the device
+  uint64 nblocks;  // blocks transferred by those requests
+  uint64 nsingle;  // requests carrying exactly one block
+  uint64 nmerged;  // requests carrying a run of adjacent blocks
+  uint64 nnotify;  // QUEUE_NOTIFY writes (each one an MMIO exit)
+  uint64 nintr;    // completion interrupts taken
+  uint64 npolled;  // batches completed by polling, without sleeping
+  uint32 qsize;    // negotiated queue size
+  uint32 features; // DISK_F_* bits
+  uint32 mode;     // DISK_MODE_*
+
+  // the log
+  uint32 ncommit;  // transactions committed
+  uint64 nlogged;  // blocks written to the log by those commits
+  uint32 nckpt;    // checkpoints, which install logged blocks home
+  uint64 ninstalled; // blocks installed by those checkpoints
+
+  // latency of single-block requests, in log2(time ticks)
+  // buckets; indexed by [polled][write][bucket].
+  uint64 lat[2][2][DISK_NLAT];
+};
+
+#define DISK_F_INDIRECT  0x1 // multi-block requests use indirect descriptors
+#define DISK_F_EVENT_IDX 0x2 // notifies and interrupts suppressed via event index
+#define DISK_F_RAMDISK   0x4 // root disk is the in-memory ramdisk
+
+// completion modes, set with diskmode().
+#define DISK_MODE_INTR 0 // sleep until the completion interrupt
+#define DISK_MODE_POLL 1 // poll the used ring briefly, then sleep
+#define DISK_MODE_HINT 2 // poll only for requests marked synchronous
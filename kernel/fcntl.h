@@ -3,3 +3,16 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800  // don't wait in read() or write()
+
+// read() and write() on an O_NONBLOCK pipe or device return
+// -EAGAIN rather than wait for data or room.
+#define EAGAIN 11
+
+// fcntl() commands
+#define F_GETPIPE_SZ    1  // pipe buffer size
+#define F_SETPIPE_SZ    2  // resize pipe buffer to at least arg bytes
+#define F_SETPIPE_HIWAT 3  // wake readers once arg bytes are buffered
+#define F_SETPIPE_LOWAT 4  // wake writers once at most arg bytes are
+#define F_GETFL         5  // the file's O_NONBLOCK flag
+#define F_SETFL         6  // set it from arg
@@ -12,6 +12,10 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
+#include "uio.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 struct {
@@ -35,6 +39,7 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->flags = 0;
       release(&ftable.lock);
       return f;
     }
@@ -112,16 +117,13 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, addr, n, f->flags);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(1, addr, n, f->flags);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = fileiread(f, 1, addr, n);
   } else {
     panic("fileread");
   }
@@ -129,54 +131,304 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Which of events (POLLIN, POLLOUT) f is ready for. If none,
+// and t isn't 0, add t to the wait queue of f's object.
+int
+filepoll(struct file *f, int events, struct polltable *t)
+{
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->readable ? events & ~POLLOUT : events & ~POLLIN, t);
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return POLLNVAL;
+    if(devsw[f->major].poll)
+      return devsw[f->major].poll(events, t);
+  }
+  // files, and devices that don't say, never block.
+  return events & (POLLIN|POLLOUT);
+}
+
+// Read from the inode of f, at f->off.
+// If user_dst==1, dst is a user virtual address;
+// otherwise, it is a kernel address.
+int
+fileiread(struct file *f, int user_dst, uint64 dst, int n)
+{
+  int r;
+
+  ilock(f->ip);
+  if((r = readi(f->ip, user_dst, dst, f->off, n)) > 0)
+    f->off += r;
+  iunlock(f->ip);
+  return r;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, addr, n, f->flags);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(1, addr, n, f->flags);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+    ret = fileiwrite(f, 1, addr, n);
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+// write as much at a time as one system call may
+// reserve in the log, counting the i-node, indirect
+// blocks, allocation blocks, and slop for non-aligned
+// writes. this really belongs lower down, since writei()
+// might be writing a device like the console.
+static int
+writemax(void)
+{
+  int max;
+
+  max = BSIZE;
+  while(writeicost(max + BSIZE) <= log_maxop())
+    max += BSIZE;
+  return max;
+}
+
+// Write to the inode of f, at f->off.
+// If user_src==1, src is a user virtual address;
+// otherwise, it is a kernel address.
+// Returns n, fewer if the disk fills up, or -1 if
+// nothing could be written.
+int
+fileiwrite(struct file *f, int user_src, uint64 src, int n)
+{
+  int r, i, n1, res, max;
+
+  max = writemax();
+  i = 0;
+  while(i < n){
+    n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    res = writeicost(n1);
+    begin_opn(res);
+    ilock(f->ip);
+    if ((r = writei(f->ip, user_src, src + i, f->off, n1)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_opn(res);
+
+    if(r < 0)
+      break;
+    i += r;
+    if(r != n1)
+      break;  // disk full
+  }
+  return i > 0 || n == 0 ? i : -1;
+}
+
+
+// Copy up to n bytes from file in, which must be a regular
+// file, to out, at their offsets, without going through user
+// space. File to file copies go block to block in the buffer
+// cache, a transaction at a time; to a pipe, they are spliced;
+// to a device, they go through a kernel page.
+// Returns the number of bytes copied, 0 at the end of in,
+// or -EAGAIN if out is O_NONBLOCK and couldn't take any.
+int
+filecopy(struct file *out, struct file *in, int n)
+{
+  struct inode *a, *b;
+  int r, w, tot, n1, res, max;
+  char *page;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE || in->ip->type != T_FILE)
+    return -1;
+
+  if(out->type == FD_PIPE)
+    return pipesplice(in, out, n, 0);
+
+  if(out->type == FD_DEVICE){
+    if(out->major < 0 || out->major >= NDEV || !devsw[out->major].write)
+      return -1;
+    if((page = kalloc()) == 0)
+      return -1;
+    for(tot = 0; tot < n; tot += r){
+      if((r = fileiread(in, 0, (uint64)page, min(n - tot, PGSIZE))) <= 0)
+        break;
+      w = devsw[out->major].write(0, (uint64)page, r, out->flags);
+      if(w != r){
+        // leave in->off just past the bytes that went out.
+        ilock(in->ip);
+        in->off -= r - (w > 0 ? w : 0);
+        iunlock(in->ip);
+        if(w > 0)
+          tot += w;
+        else if(tot == 0)
+          tot = w < 0 ? w : -1;  // -EAGAIN, say
+        break;
+      }
+    }
+    kfree(page);
+    return tot;
+  }
+
+  if(out->type != FD_INODE || out->ip == in->ip)
+    return -1;
+
+  // lock the two inodes in a fixed order, so that two copies
+  // in opposite directions can't deadlock.
+  a = in->ip < out->ip ? in->ip : out->ip;
+  b = in->ip < out->ip ? out->ip : in->ip;
+  max = writemax();
+  for(tot = 0; tot < n; tot += r){
+    n1 = min(n - tot, max);
+    res = writeicost(n1);
+    begin_opn(res);
+    ilock(a);
+    ilock(b);
+    if((r = copyi(out->ip, out->off, in->ip, in->off, n1)) > 0){
+      in->off += r;
+      out->off += r;
+    }
+    iunlock(b);
+    iunlock(a);
+    end_opn(res);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < n1){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
+// Read from f into the cnt user buffers in iov, in order,
+// at offset off, or at f->off if off is negative: only
+// inodes can be read at an offset. An inode is read under
+// one lock, and a pipe in one piperead().
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int k, r, tot;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type != FD_INODE && off >= 0)
+    return -1;
 
+  if(f->type == FD_PIPE)
+    return pipereadv(f->pipe, iov, cnt, f->flags);
+
+  tot = 0;
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
+      return -1;
+    for(k = 0; k < cnt; k++){
+      r = devsw[f->major].read(1, (uint64)iov[k].base, iov[k].len, f->flags);
       if(r < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r < iov[k].len)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    return tot;
   }
 
-  return ret;
+  ilock(f->ip);
+  o = off >= 0 ? off : f->off;
+  for(k = 0; k < cnt; k++){
+    r = readi(f->ip, 1, (uint64)iov[k].base, o, iov[k].len);
+    if(r > 0){
+      o += r;
+      tot += r;
+    }
+    if(r < iov[k].len)
+      break;
+  }
+  if(off < 0)
+    f->off = o;
+  iunlock(f->ip);
+  return tot;
 }
 
+// Write the cnt user buffers in iov to f, in order, at offset
+// off, or at f->off if off is negative. An inode is written
+// in as few transactions as the log allows, usually one, and
+// a pipe in one pipewrite().
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int k, i, m, r, n, n1, res, max, tot, total;
+  uint o;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type != FD_INODE && off >= 0)
+    return -1;
+
+  if(f->type == FD_PIPE)
+    return pipewritev(f->pipe, iov, cnt, f->flags);
+
+  tot = 0;
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+      return -1;
+    for(k = 0; k < cnt; k++){
+      r = devsw[f->major].write(1, (uint64)iov[k].base, iov[k].len, f->flags);
+      if(r < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r < iov[k].len)
+        break;
+    }
+    return tot;
+  }
+
+  total = 0;
+  for(k = 0; k < cnt; k++)
+    total += iov[k].len;
+  max = writemax();
+  k = i = 0;  // next byte is at iov[k].base + i
+  while(tot < total){
+    n1 = min(total - tot, max);
+    res = writeicost(n1);
+    begin_opn(res);
+    ilock(f->ip);
+    o = off >= 0 ? off + tot : f->off;
+    for(n = 0; n < n1; n += m, i += m){
+      while(i == iov[k].len){
+        k++;
+        i = 0;
+      }
+      m = min(n1 - n, iov[k].len - i);
+      if((r = writei(f->ip, 1, (uint64)iov[k].base + i, o + n, m)) != m){
+        n += r > 0 ? r : 0;
+        break;
+      }
+    }
+    if(off < 0)
+      f->off = o + n;
+    iunlock(f->ip);
+    end_opn(res);
+    tot += n;
+    if(n != n1)
+      return tot > 0 ? tot : -1;
+  }
+  return tot;
+}
@@ -7,6 +7,7 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  int flags;         // O_NONBLOCK
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,6 +19,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext;  // icache hash chain
+  struct inode *lprev;  // icache LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +30,20 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  uint addrs[NDIRECT+NLEVEL];
+  uint goal;          // allocate the next block here, if free
 };
 
+struct polltable;
+
 // map major device number to device functions.
+// read and write take (user, addr, n, flags); flags is the
+// file's O_NONBLOCK.
 struct devsw {
-  int (*read)(int, uint64, int);
-  int (*write)(int, uint64, int);
+  int (*read)(int, uint64, int, int);
+  int (*write)(int, uint64, int, int);
+  int (*poll)(int, struct polltable*);  // optional; see filepoll()
 };
 
 extern struct devsw devsw[];
@@ -22,10 +22,16 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define NREADAHEAD 32  // max blocks readi() reads ahead at once
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+static void bindexinit(int);
+static void iindexinit(int);
+static void dcacheinit(void);
+static void dcachepurge(struct inode*);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +50,8 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bindexinit(dev);
+  iindexinit(dev);
 }
 
 // Zero a block.
@@ -60,29 +68,118 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// In-memory summary of the free-block bitmap, built by
+// fsinit(). The bitmap blocks, updated through the log,
+// remain the truth; nfree[] lets ballocrun() skip full
+// bitmap blocks without reading them, and the cursor makes
+// allocation next-fit rather than always first-fit from
+// block 0.
+#define NBMAP 64  // max bitmap blocks, for a 512K-block disk
+
+struct {
+  struct spinlock lock;
+  int nfree[NBMAP];  // free blocks covered by each bitmap block
+  uint cursor;       // just past the last allocation
+} bindex;
+
+static void
+bindexinit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  int b, bi;
 
-  bp = 0;
+  if((sb.size + BPB - 1) / BPB > NBMAP)
+    panic("bindexinit: disk too big");
+  initlock(&bindex.lock, "bindex");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bindex.nfree[b / BPB]++;
+    brelse(bp);
+  }
+}
+
+// Return the first free bit at or after bi in bitmap
+// block data, or BPB if there is none. Full words are
+// skipped whole.
+static int
+bfirstfree(uchar *data, int bi)
+{
+  uint *w = (uint*)data;
+
+  while(bi < BPB){
+    if(bi % 32 == 0 && w[bi / 32] == 0xffffffff){
+      bi += 32;
+      continue;
     }
+    if((data[bi/8] & (1 << (bi % 8))) == 0)
+      return bi;
+    bi++;
+  }
+  return BPB;
+}
+
+// Allocate a run of up to n consecutive zeroed disk blocks,
+// starting at the first free block at or after goal, or
+// after the cursor if goal is 0, and set *got to its length.
+// The run stops at the end of the free space or of the bitmap
+// block. Returns 0 if the disk is full.
+static uint
+ballocrun(uint dev, uint goal, uint n, uint *got)
+{
+  int b, bi, m, i, nb, full;
+  uint len;
+  struct buf *bp;
+
+  nb = (sb.size + BPB - 1) / BPB;
+  acquire(&bindex.lock);
+  if(goal == 0 || goal >= sb.size)
+    goal = bindex.cursor;
+  release(&bindex.lock);
+  // goal's bitmap block is scanned twice: first from goal,
+  // last from its start.
+  for(i = 0; i <= nb; i++){
+    b = ((goal / BPB + i) % nb) * BPB;
+    acquire(&bindex.lock);
+    full = bindex.nfree[b / BPB] == 0;
+    release(&bindex.lock);
+    if(full)
+      continue;
+    bp = bread(dev, BBLOCK(b, sb));
+    bi = bfirstfree(bp->data, i == 0 ? goal % BPB : 0);
+    if(bi == BPB || b + bi >= sb.size){
+      brelse(bp);
+      continue;
+    }
+    for(len = 0; len < n && bi + len < BPB && b + bi + len < sb.size; len++){
+      m = 1 << ((bi + len) % 8);
+      if(bp->data[(bi + len)/8] & m)
+        break;
+      bp->data[(bi + len)/8] |= m;  // Mark block in use.
+    }
+    log_write(bp);
+    acquire(&bindex.lock);
+    bindex.nfree[b / BPB] -= len;
+    bindex.cursor = b + bi + len;
+    release(&bindex.lock);
     brelse(bp);
+    for(i = 0; i < len; i++)
+      bzero(dev, b + bi + i);
+    *got = len;
+    return b + bi;
   }
-  panic("balloc: out of blocks");
+  return 0;
+}
+
+// Allocate a zeroed disk block, at goal if it is free.
+// Returns 0 if the disk is full.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint got;
+
+  return ballocrun(dev, goal, 1, &got);
 }
 
 // Free a disk block.
@@ -99,6 +196,9 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&bindex.lock);
+  bindex.nfree[b / BPB]++;
+  release(&bindex.lock);
   brelse(bp);
 }
 
@@ -162,56 +262,232 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
+// The icache is a hash table keyed by (dev, inum). Entries
+// live in pages carved into slots. The pages for the first
+// NINODE slots are allocated at boot and kept: their entries
+// stay cached and valid when ip->ref falls to zero, on an LRU
+// list, so reopening a recently used file needn't read its
+// dinode, and iget() recycles the least recently used one
+// when it needs a slot. If every kept slot is referenced,
+// iget() allocates extra pages, whose entries are freed as
+// soon as they are unreferenced, and the pages with them.
+//
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries, the hash chains, and the LRU list. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and
+// ip->inum indicate which i-node an entry holds, one must hold
+// icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61  // hash chains
+
+// a page of icache slots.
+struct ipage {
+  int nused;  // slots holding an entry
+  int keep;   // allocated at boot; never freed
+  struct inode inode[];
+};
+#define IPERPAGE ((PGSIZE - sizeof(struct ipage)) / sizeof(struct inode))
+#define IPAGE(ip) ((struct ipage*)PGROUNDDOWN((uint64)(ip)))
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *free;  // empty slots, through hnext
+  struct inode lru;    // unreferenced entries; lru.lnext is the most recent
 } icache;
 
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIHASH;
+}
+
+// Carve a new page into empty slots.
+static int
+ipagealloc(int keep)
+{
+  struct ipage *pg;
+  int i;
+
+  if((pg = kalloc()) == 0)
+    return -1;
+  pg->nused = 0;
+  pg->keep = keep;
+  for(i = 0; i < IPERPAGE; i++){
+    initsleeplock(&pg->inode[i].lock, "inode");
+    pg->inode[i].hnext = icache.free;
+    icache.free = &pg->inode[i];
+  }
+  return 0;
+}
+
+static void
+unhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &icache.hash[ihash(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+    ;
+  *pp = ip->hnext;
+}
+
+static void
+lruremove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+}
+
+// Find a slot for a new entry: an empty one, else the least
+// recently used unreferenced entry, else a new page's.
+static struct inode*
+islotalloc(void)
+{
+  struct inode *ip;
+
+  if(icache.free == 0 && icache.lru.lprev != &icache.lru){
+    ip = icache.lru.lprev;
+    lruremove(ip);
+    unhash(ip);
+    return ip;
+  }
+  if(icache.free == 0 && ipagealloc(0) < 0)
+    return 0;
+  ip = icache.free;
+  icache.free = ip->hnext;
+  IPAGE(ip)->nused++;
+  return ip;
+}
+
+// Empty the slot of an unhashed entry, freeing its page if
+// that was the last entry in an extra page.
+static void
+islotfree(struct inode *ip)
+{
+  struct ipage *pg = IPAGE(ip);
+  struct inode **pp;
+
+  ip->hnext = icache.free;
+  icache.free = ip;
+  if(--pg->nused > 0 || pg->keep)
+    return;
+  for(pp = &icache.free; *pp; ){
+    if(IPAGE(*pp) == pg)
+      *pp = (*pp)->hnext;
+    else
+      pp = &(*pp)->hnext;
+  }
+  kfree(pg);
+}
+
 void
 iinit()
 {
-  int i = 0;
+  int i;
   
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.lru.lnext = icache.lru.lprev = &icache.lru;
+  dcacheinit();
+  for(i = 0; i < NINODE; i += IPERPAGE)
+    if(ipagealloc(1) < 0)
+      panic("iinit");
 }
 
 static struct inode* iget(uint dev, uint inum);
 
-// Allocate an inode on device dev.
+// In-memory map of allocated inodes, built by fsinit(), so
+// that ialloc() needn't read inode blocks looking for a free
+// one. The dinode types on disk remain the truth: a bit is
+// set before ialloc() claims the inode and cleared after
+// iput() frees it.
+#define NIMAP 8192  // max inodes
+
+struct {
+  struct spinlock lock;
+  uchar used[NIMAP/8];
+  uint cursor;  // just past the last inode allocated
+} iindex;
+
+static void
+iindexinit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int base, inum;
+
+  if(sb.ninodes > NIMAP)
+    panic("iindexinit: too many inodes");
+  initlock(&iindex.lock, "iindex");
+  iindex.used[0] = 1;  // inode 0 is never used
+  // a block of inodes at a time.
+  for(base = 0; base < sb.ninodes; base += IPB){
+    bp = bread(dev, IBLOCK(base, sb));
+    for(inum = base; inum < base + IPB && inum < sb.ninodes; inum++){
+      dip = (struct dinode*)bp->data + inum%IPB;
+      if(inum > 0 && dip->type != 0)
+        iindex.used[inum/8] |= 1 << (inum % 8);
+    }
+    brelse(bp);
+  }
+  iindex.cursor = 1;
+}
+
+// Claim a free inode number in the index, searching
+// from near, or from the cursor if near is 0.
+// Returns 0 if there are none.
+static uint
+iindexalloc(uint near)
+{
+  uint i, inum, start;
+
+  acquire(&iindex.lock);
+  start = near ? near : iindex.cursor;
+  for(i = 0; i < sb.ninodes; i++){
+    inum = (start + i) % sb.ninodes;
+    if(inum % 8 == 0 && iindex.used[inum/8] == 0xff && i + 8 <= sb.ninodes){
+      i += 7;  // the whole byte is in use
+      continue;
+    }
+    if((iindex.used[inum/8] & (1 << (inum % 8))) == 0){
+      iindex.used[inum/8] |= 1 << (inum % 8);
+      if(near == 0)
+        iindex.cursor = inum + 1;
+      release(&iindex.lock);
+      return inum;
+    }
+  }
+  release(&iindex.lock);
+  return 0;
+}
+
+// Allocate an inode on device dev, close to inode near
+// (e.g. the new file's directory) if near isn't 0.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
-  }
-  panic("ialloc: no inodes");
+  if((inum = iindexalloc(near)) == 0)
+    panic("ialloc: no inodes");
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  if(type == T_FILE)
+    dip->flags = I_EXTENT;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -231,6 +507,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->flags = ip->flags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -242,31 +519,33 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  uint h;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  h = ihash(dev, inum);
+  for(ip = icache.hash[h]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref == 0)
+        lruremove(ip);
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Recycle an inode cache entry.
-  if(empty == 0)
+  if((ip = islotalloc()) == 0)
     panic("iget: no inodes");
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = icache.hash[h];
+  icache.hash[h] = ip;
   release(&icache.lock);
 
   return ip;
@@ -304,6 +583,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->flags = dip->flags;
+    ip->goal = 0;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -343,17 +624,35 @@ iput(struct inode *ip)
 
     release(&icache.lock);
 
+    if(ip->type == T_DIR)
+      dcachepurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
+    acquire(&iindex.lock);
+    iindex.used[ip->inum/8] &= ~(1 << (ip->inum % 8));
+    release(&iindex.lock);
+
     releasesleep(&ip->lock);
 
     acquire(&icache.lock);
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    if(ip->valid && IPAGE(ip)->keep){
+      // keep it cached, as the most recently used.
+      ip->lnext = icache.lru.lnext;
+      ip->lprev = &icache.lru;
+      icache.lru.lnext->lprev = ip;
+      icache.lru.lnext = ip;
+    } else {
+      unhash(ip);
+      islotfree(ip);
+    }
+  }
   release(&icache.lock);
 }
 
@@ -370,38 +669,301 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The NDINDIRECT blocks
+// after those are reached through the double-indirect block
+// ip->addrs[NDIRECT+1], which lists NINDIRECT indirect
+// blocks, and the NTINDIRECT after those through the
+// triple-indirect block ip->addrs[NDIRECT+2].
+//
+// Regular files created by the kernel are instead mapped by
+// extents (I_EXTENT); see fs.h. Their blocks are allocated a
+// run at a time, so a file written sequentially is a few
+// extents that bmap() can search without reading any block.
+
+// Extents past the first NIEXTENT live in a chain of extent
+// blocks, starting at ip->addrs[EXTBLOCK]. An ecursor walks
+// the chain as eslot() is asked for slots 0, 1, 2, ...,
+// holding the block with the current slot and the one
+// before it, so that the previous extent stays valid too.
+struct ecursor {
+  struct buf *bp;    // extent block k of the chain
+  struct buf *prev;  // extent block k-1
+  int k;
+};
+
+#define ELINK(bp) (((struct extent*)(bp)->data)[NEXTENT].start)
+
+static void
+einit(struct ecursor *c)
+{
+  c->bp = c->prev = 0;
+  c->k = -1;
+}
+
+static void
+edone(struct ecursor *c)
+{
+  if(c->bp)
+    brelse(c->bp);
+  if(c->prev)
+    brelse(c->prev);
+}
+
+// Extent i of ip, where i is the slot last asked for or
+// the one after it. Returns 0 if slot i needs an extent
+// block that ip doesn't have, unless alloc is set and one
+// can be allocated and added to the chain.
+static struct extent*
+eslot(struct inode *ip, struct ecursor *c, int i, int alloc)
+{
+  struct buf *bp;
+  uint *link, got;
+
+  if(i < NIEXTENT)
+    return (struct extent*)ip->addrs + i;
+  i -= NIEXTENT;
+  if(i / NEXTENT != c->k){
+    if(i / NEXTENT != c->k + 1)
+      panic("eslot");
+    link = c->bp ? &ELINK(c->bp) : &ip->addrs[EXTBLOCK];
+    if(*link == 0){
+      if(!alloc || (*link = ballocrun(ip->dev, 0, 1, &got)) == 0)
+        return 0;
+      if(c->bp)
+        log_write(c->bp);
+    }
+    bp = bread(ip->dev, *link);
+    if(c->prev)
+      brelse(c->prev);
+    c->prev = c->bp;
+    c->bp = bp;
+    c->k++;
+  }
+  return (struct extent*)c->bp->data + i % NEXTENT;
+}
+
+// Log the extent block holding e, unless e is in ip->addrs.
+static void
+elog(struct ecursor *c, struct extent *e)
+{
+  struct buf *bp;
+  int i;
+
+  for(i = 0; i < 2; i++){
+    bp = i == 0 ? c->bp : c->prev;
+    if(bp && (uchar*)e >= bp->data && (uchar*)e < bp->data + BSIZE)
+      log_write(bp);
+  }
+}
+
+// Return the disk address of block bn of extent-mapped ip,
+// and set *run to the number of blocks from there to the end
+// of its extent. Returns 0 if bn isn't allocated.
+static uint
+emap(struct inode *ip, uint bn, uint *run)
+{
+  struct ecursor c;
+  struct extent *e;
+  uint addr;
+  int i;
+
+  einit(&c);
+  addr = 0;
+  for(i = 0; (e = eslot(ip, &c, i, 0)) != 0 && e->len > 0; i++){
+    if(bn < e->len){
+      addr = e->start + bn;
+      *run = e->len - bn;
+      break;
+    }
+    bn -= e->len;
+  }
+  edone(&c);
+  return addr;
+}
+
+// Allocate blocks at the end of extent-mapped ip until it
+// has n, a run at a time, extending the last extent when the
+// new run follows it. Returns -1 if the disk is full.
+// Caller must iupdate(ip).
+static int
+eextend(struct inode *ip, uint n)
+{
+  struct ecursor c;
+  struct extent *e, *last;
+  uint have, start, got, j;
+  int i, r;
+
+  einit(&c);
+  have = 0;
+  last = 0;
+  for(i = 0; (e = eslot(ip, &c, i, 0)) != 0 && e->len > 0; i++){
+    have += e->len;
+    last = e;
+  }
+
+  r = 0;
+  while(have < n){
+    start = ballocrun(ip->dev, last ? last->start + last->len : ip->goal,
+                      n - have, &got);
+    if(start == 0){
+      r = -1;
+      break;
+    }
+    ip->goal = start + got;
+    if(last && start == last->start + last->len){
+      last->len += got;
+    } else {
+      if((e = eslot(ip, &c, i, 1)) == 0){
+        for(j = 0; j < got; j++)
+          bfree(ip->dev, start + j);
+        r = -1;
+        break;
+      }
+      e->start = start;
+      e->len = got;
+      last = e;
+      i++;
+    }
+    elog(&c, last);
+    have += got;
+  }
+  edone(&c);
+  return r;
+}
+
+// How many disk blocks does extent-mapped ip use?
+static uint
+eblocks(struct inode *ip)
+{
+  struct ecursor c;
+  struct extent *e;
+  uint tot;
+  int i;
+
+  einit(&c);
+  tot = 0;
+  for(i = 0; (e = eslot(ip, &c, i, 0)) != 0 && e->len > 0; i++)
+    tot += e->len;
+  edone(&c);
+  // and the extent blocks.
+  return tot + c.k + 1;
+}
+
+// Free every block of extent-mapped ip.
+static void
+etrunc(struct inode *ip)
+{
+  struct ecursor c;
+  struct extent *e;
+  struct buf *bp;
+  uint b, next, j;
+  int i;
+
+  einit(&c);
+  for(i = 0; (e = eslot(ip, &c, i, 0)) != 0 && e->len > 0; i++)
+    for(j = 0; j < e->len; j++)
+      bfree(ip->dev, e->start + j);
+  edone(&c);
+  for(b = ip->addrs[EXTBLOCK]; b != 0; b = next){
+    bp = bread(ip->dev, b);
+    next = ELINK(bp);
+    brelse(bp);
+    bfree(ip->dev, b);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+}
+
+// Allocate a block for block-mapped ip, following the
+// last one allocated to it if that is free. Returns 0 if
+// the disk is full.
+static uint
+iballoc(struct inode *ip)
+{
+  uint b;
+
+  if((b = balloc(ip->dev, ip->goal)) != 0)
+    ip->goal = b + 1;
+  return b;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one; it returns
+// 0 if it can't. Indirect blocks allocated on the way stay
+// with ip, to be used by the next write or freed by itrunc().
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, run;
+  uint64 span;
   struct buf *bp;
+  int level;
+
+  if(ip->flags & I_EXTENT){
+    if((addr = emap(ip, bn, &run)) == 0){
+      eextend(ip, bn + 1);
+      addr = emap(ip, bn, &run);
+    }
+    return addr;
+  }
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = iballoc(ip);
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the level of indirection, and how many blocks
+  // each entry of the top indirect block covers.
+  span = 1;
+  for(level = 0; level < NLEVEL; level++){
+    if(bn < span * NINDIRECT)
+      break;
+    bn -= span * NINDIRECT;
+    span *= NINDIRECT;
+  }
+  if(level == NLEVEL)
+    panic("bmap: out of range");
+
+  if((addr = ip->addrs[NDIRECT+level]) == 0)
+    if((ip->addrs[NDIRECT+level] = addr = iballoc(ip)) == 0)
+      return 0;
+
+  // Walk down the indirect blocks, allocating if necessary.
+  for(; span > 0 && addr != 0; span /= NINDIRECT){
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    if((addr = a[bn / span]) == 0){
+      if((a[bn / span] = addr = iballoc(ip)) != 0)
+        log_write(bp);
     }
     brelse(bp);
-    return addr;
+    bn %= span;
   }
+  return addr;
+}
+
+// Free indirect block addr, which is level levels above
+// the data blocks, and every block it leads to.
+static void
+bfreeind(int dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      bfreeind(dev, a[j], level - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -409,9 +971,14 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(ip->flags & I_EXTENT){
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -420,22 +987,41 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreeind(ip->dev, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
   iupdate(ip);
 }
 
+// How many disk blocks does a block-mapped file of size
+// bytes use? Files have no holes, so these are the data
+// blocks and the indirect blocks that map them.
+static uint
+countblocks(uint size)
+{
+  uint64 n, m, cap, span;
+  uint tot;
+  int level;
+
+  n = (size + BSIZE - 1) / BSIZE;
+  tot = n;
+  n -= min(n, NDIRECT);
+  cap = NINDIRECT;
+  for(level = 0; level < NLEVEL && n > 0; level++){
+    m = n < cap ? n : cap;
+    n -= m;
+    for(span = NINDIRECT; span <= cap; span *= NINDIRECT)
+      tot += (m + span - 1) / span;
+    cap *= NINDIRECT;
+  }
+  return tot;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -446,6 +1032,10 @@ stati(struct inode *ip, struct stat *st)
   st->type = ip->type;
   st->nlink = ip->nlink;
   st->size = ip->size;
+  if(ip->flags & I_EXTENT)
+    st->blocks = eblocks(ip);
+  else
+    st->blocks = countblocks(ip->size);
 }
 
 // Read data from inode.
@@ -455,16 +1045,31 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, bn, ra, addr, run, last;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n == 0)
+    return 0;
 
+  last = (off + n - 1) / BSIZE;
+  ra = 0;  // blocks before ra have been read ahead
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bn = off/BSIZE;
+    if((ip->flags & I_EXTENT) && bn >= ra){
+      // read the rest of this extent that we need, up to
+      // NREADAHEAD blocks, as one merged disk request.
+      if((addr = emap(ip, bn, &run)) == 0)
+        panic("readi: hole");
+      run = min(run, min(last - bn + 1, NREADAHEAD));
+      if(run > 1)
+        breadahead(ip->dev, addr, run);
+      ra = bn + run;
+    }
+    bp = bread(ip->dev, bmap(ip, bn));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -482,16 +1087,23 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
+  // MAXFILE blocks is more than a uint offset can reach, so
+  // the size only has to stay within a uint.
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
-    return -1;
+
+  // allocate all the new blocks at once, so that
+  // they are contiguous if the free space allows.
+  if((ip->flags & I_EXTENT) && n > 0)
+    eextend(ip, (off + n + BSIZE - 1) / BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
@@ -510,7 +1122,74 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     iupdate(ip);
   }
 
-  return n;
+  return tot;
+}
+
+// Copy n bytes at soff in src to doff in dst, straight from
+// one buffer-cache block to the other. Caller must hold both
+// locks, and src must not be dst. Returns the number of bytes
+// copied, fewer than n at the end of src or if the disk fills
+// up, or -1 if dst can't hold any of them.
+int
+copyi(struct inode *dst, uint doff, struct inode *src, uint soff, uint n)
+{
+  uint tot, m, bn, ra, addr, run, last;
+  struct buf *sbp, *dbp;
+
+  if(doff > dst->size || doff + n < doff)
+    return -1;
+  if(soff > src->size || soff + n < soff)
+    return 0;
+  if(soff + n > src->size)
+    n = src->size - soff;
+  if(n == 0)
+    return 0;
+
+  if(dst->flags & I_EXTENT)
+    eextend(dst, (doff + n + BSIZE - 1) / BSIZE);
+
+  last = (soff + n - 1) / BSIZE;
+  ra = 0;  // as in readi()
+  for(tot=0; tot<n; tot+=m, soff+=m, doff+=m){
+    bn = soff/BSIZE;
+    if((src->flags & I_EXTENT) && bn >= ra){
+      if((addr = emap(src, bn, &run)) == 0)
+        panic("copyi: hole");
+      run = min(run, min(last - bn + 1, NREADAHEAD));
+      if(run > 1)
+        breadahead(src->dev, addr, run);
+      ra = bn + run;
+    }
+    if((addr = bmap(dst, doff/BSIZE)) == 0)
+      break;
+    m = min(n - tot, min(BSIZE - soff%BSIZE, BSIZE - doff%BSIZE));
+    sbp = bread(src->dev, bmap(src, bn));
+    dbp = bread(dst->dev, addr);
+    memmove(dbp->data + doff%BSIZE, sbp->data + soff%BSIZE, m);
+    log_write(dbp);
+    brelse(dbp);
+    brelse(sbp);
+  }
+
+  if(doff > dst->size)
+    dst->size = doff;
+  iupdate(dst);
+  return tot > 0 ? tot : -1;
+}
+
+// How many blocks might writei() log when writing n bytes?
+// The data blocks (plus one if the write is unaligned),
+// the indirect blocks at each level that map them, the
+// bitmap blocks that record their allocation, and the inode.
+int
+writeicost(uint n)
+{
+  int data, nbitmap;
+
+  data = n / BSIZE + 2;
+  nbitmap = sb.size / BPB + 1;
+  return data + data / NINDIRECT + 2 + data / NDINDIRECT + 2 + 1 +
+    min(data, nbitmap) + 1;
 }
 
 // Directories
@@ -521,40 +1200,699 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// The dcache remembers what dirlookup() found: the inum that
+// name maps to in directory parent, or 0 if it isn't there.
+// It is direct-mapped; an insert evicts whatever shared the
+// slot. Entries change only while their directory is locked:
+// namex(), dirlink() and dirunlink() record names, and iput()
+// purges a freed directory's entries.
+//
+// Readers take no lock. Writers serialize on dcache.lock
+// and make an entry's seq odd while they update it; a
+// reader retries if seq was odd or changed while it looked.
+// Each entry has its own seq, so a reader is disturbed
+// only by changes to the entry it reads.
+//
+// Names longer than DNAMELEN aren't cached.
+
+#define NDCACHE 512
+#define DNAMELEN 28
+
+struct dentry {
+  uint dev;
+  uint parent;
+  uint inum;  // 0: name is not in parent
+  char name[DNAMELEN];
+  int valid;
+  uint seq;   // odd while being changed
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+} dcache;
+
+static uint
+dhash(uint dev, uint parent, const char *name)
+{
+  uint h = dev * 31 + parent;
+  int i;
+
+  for(i = 0; name[i]; i++)
+    h = h * 31 + name[i];
+  return h % NDCACHE;
+}
+
+static void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// Look name up in directory dp without locking it.
+// Returns 1 and sets *inum if the dcache knows the
+// answer (0 if there is no such name), else returns 0.
+// Sets *pd and *pseq for dcachestill().
+static int
+dcachelookup(struct inode *dp, char *name, uint *inum,
+             struct dentry **pd, uint *pseq)
+{
+  struct dentry *d;
+  uint seq;
+  int hit;
+
+  if(strlen(name) > DNAMELEN)
+    return 0;
+  d = &dcache.ent[dhash(dp->dev, dp->inum, name)];
+  for(;;){
+    seq = __atomic_load_n(&d->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1)
+      continue;
+    hit = d->valid && d->dev == dp->dev && d->parent == dp->inum &&
+      strncmp(d->name, name, DNAMELEN) == 0;
+    *inum = d->inum;
+    __sync_synchronize();
+    if(__atomic_load_n(&d->seq, __ATOMIC_RELAXED) == seq){
+      *pd = d;
+      *pseq = seq;
+      return hit;
+    }
+  }
+}
+
+// Is entry d unchanged since dcachelookup() set seq?
+// Unlinking a name clears its entry before the inode can be
+// freed, so if it hasn't changed, an inode the lookup found
+// and the caller has since taken a reference to is still the
+// one the name refers to.
+static int
+dcachestill(struct dentry *d, uint seq)
+{
+  __sync_synchronize();
+  return __atomic_load_n(&d->seq, __ATOMIC_ACQUIRE) == seq;
+}
+
+// Record that name is inum (0 if absent) in directory dp.
+// Caller must hold dp->lock.
+static void
+dcacheset(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+
+  if(strlen(name) > DNAMELEN)
+    return;
+  d = &dcache.ent[dhash(dp->dev, dp->inum, name)];
+  acquire(&dcache.lock);
+  __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELAXED);
+  __sync_synchronize();
+  d->dev = dp->dev;
+  d->parent = dp->inum;
+  d->inum = inum;
+  strncpy(d->name, name, DNAMELEN);
+  d->valid = 1;
+  __sync_synchronize();
+  __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELEASE);
+  release(&dcache.lock);
+}
+
+// Forget every entry in directory dp, which is being freed,
+// so that they can't apply to a new inode with its inum.
+static void
+dcachepurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDCACHE]; d++){
+    if(d->valid && d->dev == dp->dev && d->parent == dp->inum){
+      __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELAXED);
+      __sync_synchronize();
+      d->valid = 0;
+      __sync_synchronize();
+      __atomic_store_n(&d->seq, d->seq + 1, __ATOMIC_RELEASE);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Directory blocks; see fs.h.
+
+#define NDIRENT (BSIZE / DIRENTSZ(1))  // most dirents in a block
+
+// The dirent at off in directory block data.
+static struct dirent*
+dirent(uchar *data, uint off)
+{
+  struct dirent *de;
+
+  de = (struct dirent*)(data + off);
+  if(de->reclen < DIRENTSZ(0) || (de->reclen & 3) || off + de->reclen > BSIZE ||
+     (de->inum != 0 && DIRENTSZ(de->namelen) > de->reclen))
+    panic("bad dirent");
+  return de;
+}
+
+// Make data an empty directory block: one free dirent.
+static void
+dirblkinit(uchar *data)
+{
+  struct dirent *de;
+
+  de = (struct dirent*)data;
+  de->inum = 0;
+  de->reclen = BSIZE;
+  de->namelen = 0;
+}
+
+// Look for name in directory block data.
+// Returns the dirent, or 0 if it isn't there.
+static struct dirent*
+dirblkfind(uchar *data, char *name)
+{
+  struct dirent *de;
+  uint off;
+  int len;
+
+  len = strlen(name);
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = dirent(data, off);
+    if(de->inum != 0 && de->namelen == len && memcmp(de->name, name, len) == 0)
+      return de;
+  }
+  return 0;
+}
+
+// Put (name, inum) in the free space of directory block
+// data. Returns 0, or -1 if there isn't room.
+static int
+dirblkadd(uchar *data, char *name, uint inum)
+{
+  struct dirent *de, *nde;
+  uint off, used;
+  int len;
+
+  len = strlen(name);
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = dirent(data, off);
+    used = de->inum ? DIRENTSZ(de->namelen) : 0;
+    if(de->reclen - used < DIRENTSZ(len))
+      continue;
+    if(used){
+      // split the free space off the end of de.
+      nde = (struct dirent*)(data + off + used);
+      nde->reclen = de->reclen - used;
+      de->reclen = used;
+      de = nde;
+    }
+    de->inum = inum;
+    de->namelen = len;
+    de->pad = 0;
+    memmove(de->name, name, len);
+    return 0;
+  }
+  return -1;
+}
+
+// Add a block to the end of directory dp, holding no
+// entries, and return its number within dp, or -1 if the
+// disk is full.
+static int
+dirgrow(struct inode *dp)
+{
+  struct buf *bp;
+  uint blk, addr;
+
+  blk = dp->size / BSIZE;
+  if((addr = bmap(dp, blk)) == 0){
+    iupdate(dp);  // bmap() may have added indirect blocks.
+    return -1;
+  }
+  bp = bread(dp->dev, addr);
+  dirblkinit(bp->data);
+  log_write(bp);
+  brelse(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+  return blk;
+}
+
+// Allocate disk blocks for the next n blocks past the end
+// of directory dp, so that the next n dirgrow()s can't fail.
+// Returns -1 if the disk is full; any blocks allocated stay
+// past the end, for dirgrow() to use later.
+static int
+dirreserve(struct inode *dp, int n)
+{
+  int i, r;
+
+  r = 0;
+  for(i = 0; i < n && r == 0; i++)
+    if(bmap(dp, dp->size / BSIZE + i) == 0)
+      r = -1;
+  iupdate(dp);
+  return r;
+}
+
+// Look for name in block blk of directory dp.
+static uint
+dirfindin(struct inode *dp, uint blk, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum;
+
+  bp = bread(dp->dev, bmap(dp, blk));
+  inum = 0;
+  if((de = dirblkfind(bp->data, name)) != 0){
+    inum = de->inum;
+    if(poff)
+      *poff = blk*BSIZE + ((uchar*)de - bp->data);
+  }
+  brelse(bp);
+  return inum;
+}
+
+// Put (name, inum) in block blk of directory dp, if it fits.
+static int
+diraddto(struct inode *dp, uint blk, char *name, uint inum)
+{
+  struct buf *bp;
+  int r;
+
+  bp = bread(dp->dev, bmap(dp, blk));
+  if((r = dirblkadd(bp->data, name, inum)) == 0)
+    log_write(bp);
+  brelse(bp);
+  return r;
+}
+
+// Indexed directories; see fs.h.
+
+// The way from the root of a directory's index to a leaf.
+struct dxpath {
+  int levels;
+  uint blk[DXMAXLEVEL+1];  // index blocks, then the leaf
+  int pos[DXMAXLEVEL];     // entry followed in each index block
+  int room[DXMAXLEVEL];    // whether each index block has space
+};
+
+// Name hashes are even. An index entry with an odd hash, h|1,
+// points at a continuation leaf: when a full leaf's names all
+// hash to h, more names with hash h go in the leaves after
+// it whose entries say h|1.
+static uint
+dxhash(char *name, int len)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < len; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h & ~1;
+}
+
+// The dxhead of index block blk, held in bp.
+static struct dxhead*
+dxhead(struct buf *bp, uint blk)
+{
+  return (struct dxhead*)(bp->data + (blk == 0 ? DXROOT : DXNODE));
+}
+
+// Find the leaf of indexed directory dp that holds names
+// whose hash is h, and record the way there in *p.
+static void
+dxfind(struct inode *dp, uint h, struct dxpath *p)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint blk;
+  int l, lo, hi, mid;
+
+  blk = 0;
+  for(l = 0; l == 0 || l < p->levels; l++){
+    bp = bread(dp->dev, bmap(dp, blk));
+    hd = dxhead(bp, blk);
+    if(l == 0)
+      p->levels = hd->levels;
+    if(p->levels < 1 || p->levels > DXMAXLEVEL || hd->count < 1)
+      panic("dxfind");
+    e = (struct dxentry*)(hd + 1);
+    // the last entry whose hash is at most h.
+    lo = 0;
+    hi = hd->count - 1;
+    while(lo < hi){
+      mid = (lo + hi + 1) / 2;
+      if(e[mid].hash <= h)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    p->blk[l] = blk;
+    p->pos[l] = lo;
+    p->room[l] = hd->count < (blk == 0 ? NDXROOT : NDXENT);
+    blk = e[lo].block;
+    brelse(bp);
+  }
+  p->blk[l] = blk;
+}
+
+// Move p on to the next leaf in hash order, and return the
+// hash in its index entry, or 0 if p was at the last leaf.
+static uint
+dxnext(struct inode *dp, struct dxpath *p)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint h;
+  int l, n;
+
+  // the deepest index block with an entry after the one
+  // followed; then down its first entries.
+  for(l = p->levels - 1; l >= 0; l--){
+    bp = bread(dp->dev, bmap(dp, p->blk[l]));
+    n = dxhead(bp, p->blk[l])->count;
+    brelse(bp);
+    if(p->pos[l] + 1 < n)
+      break;
+  }
+  if(l < 0)
+    return 0;
+  p->pos[l]++;
+  h = 0;
+  for(; l < p->levels; l++){
+    bp = bread(dp->dev, bmap(dp, p->blk[l]));
+    hd = dxhead(bp, p->blk[l]);
+    e = (struct dxentry*)(hd + 1);
+    p->room[l] = hd->count < (p->blk[l] == 0 ? NDXROOT : NDXENT);
+    h = e[p->pos[l]].hash;
+    p->blk[l+1] = e[p->pos[l]].block;
+    if(l + 1 < p->levels)
+      p->pos[l+1] = 0;
+    brelse(bp);
+  }
+  return h;
+}
+
+// Index dp, whose one block is full: move all but "." and
+// ".." to a new leaf, and point the root index at it.
+// Returns -1, leaving dp as it was, if the disk is full.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *rb, *lb;
+  struct dirent *de, *dot, *dotdot, *last;
+  struct dxhead *hd;
+  struct dxentry *e;
+  uint off, loff, dotinum, dotdotinum;
+  int leaf;
+
+  if((leaf = dirgrow(dp)) < 0)
+    return -1;
+  rb = bread(dp->dev, bmap(dp, 0));
+  lb = bread(dp->dev, bmap(dp, leaf));
+  dot = dirent(rb->data, 0);
+  dotdot = dirent(rb->data, dot->reclen);
+  dotinum = dot->inum;
+  dotdotinum = dotdot->inum;
+  loff = 0;
+  last = 0;
+  for(off = dot->reclen + dotdot->reclen; off < BSIZE; off += de->reclen){
+    de = dirent(rb->data, off);
+    if(de->inum == 0)
+      continue;
+    last = (struct dirent*)(lb->data + loff);
+    memmove(last, de, DIRENTSZ(de->namelen));
+    last->reclen = DIRENTSZ(de->namelen);
+    loff += last->reclen;
+  }
+  if(last)
+    last->reclen += BSIZE - loff;
+
+  memset(rb->data, 0, BSIZE);
+  dot = (struct dirent*)rb->data;
+  dot->inum = dotinum;
+  dot->reclen = DIRENTSZ(1);
+  dot->namelen = 1;
+  dot->name[0] = '.';
+  dotdot = (struct dirent*)(rb->data + DIRENTSZ(1));
+  dotdot->inum = dotdotinum;
+  dotdot->reclen = BSIZE - DIRENTSZ(1);
+  dotdot->namelen = 2;
+  dotdot->name[0] = dotdot->name[1] = '.';
+  hd = dxhead(rb, 0);
+  hd->levels = 1;
+  hd->count = 1;
+  e = (struct dxentry*)(hd + 1);
+  e[0].hash = 0;
+  e[0].block = leaf;
+  log_write(lb);
+  log_write(rb);
+  brelse(lb);
+  brelse(rb);
+  dp->flags |= I_DIRINDEX;
+  iupdate(dp);
+  return 0;
+}
+
+// Choose where to split full leaf blk to make room for a
+// name with hash nh: the median name hash, or if the lower
+// half all share a hash, the next one up. If all of its
+// names share a hash, split between them and nh; returns 0
+// if that is nh too.
+static uint
+dxsplitkey(struct inode *dp, uint blk, uint nh)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint h[NDIRENT], x, off;
+  int i, j, n;
+
+  bp = bread(dp->dev, bmap(dp, blk));
+  n = 0;
+  for(off = 0; off < BSIZE; off += de->reclen){
+    de = dirent(bp->data, off);
+    if(de->inum == 0)
+      continue;
+    x = dxhash(de->name, de->namelen);
+    for(j = n; j > 0 && h[j-1] > x; j--)
+      h[j] = h[j-1];
+    h[j] = x;
+    n++;
+  }
+  brelse(bp);
+  for(i = n/2; i < n; i++)
+    if(h[i] > h[0])
+      return h[i];
+  if(n == 0 || nh == h[0])
+    return 0;
+  return nh > h[0] ? nh : h[0];
+}
+
+// Move the dirents of leaf from whose hash is at least
+// split to the empty leaf to, and pack the ones that stay.
+static void
+dxmove(struct inode *dp, uint from, uint to, uint split)
+{
+  struct buf *fb, *tb;
+  struct dirent *de, *flast, *tlast;
+  uint off, next, foff, toff, sz;
+
+  fb = bread(dp->dev, bmap(dp, from));
+  tb = bread(dp->dev, bmap(dp, to));
+  foff = toff = 0;
+  flast = tlast = 0;
+  for(off = 0; off < BSIZE; off = next){
+    de = dirent(fb->data, off);
+    next = off + de->reclen;
+    if(de->inum == 0)
+      continue;
+    sz = DIRENTSZ(de->namelen);
+    if(dxhash(de->name, de->namelen) >= split){
+      tlast = (struct dirent*)(tb->data + toff);
+      memmove(tlast, de, sz);
+      tlast->reclen = sz;
+      toff += sz;
+    } else {
+      // foff <= off, so this doesn't disturb the dirents
+      // not yet looked at.
+      flast = (struct dirent*)(fb->data + foff);
+      memmove(flast, de, sz);
+      flast->reclen = sz;
+      foff += sz;
+    }
+  }
+  if(flast)
+    flast->reclen += BSIZE - foff;
+  else
+    dirblkinit(fb->data);
+  if(tlast)
+    tlast->reclen += BSIZE - toff;
+  log_write(fb);
+  log_write(tb);
+  brelse(fb);
+  brelse(tb);
+}
+
+// Add an entry (hash, child) to index block p->blk[l], just
+// after the entry that dxfind() followed, splitting the block
+// if it is full. The caller has checked that there is room
+// for the split to end somewhere, and reserved the blocks
+// it takes.
+static void
+dxinsert(struct inode *dp, struct dxpath *p, int l, uint hash, uint child)
+{
+  struct buf *bp, *nb;
+  struct dxhead *hd, *nh;
+  struct dxentry *e, *ne;
+  uint blk;
+  int nblk, pos, half;
+
+  blk = p->blk[l];
+  pos = p->pos[l] + 1;
+  bp = bread(dp->dev, bmap(dp, blk));
+  hd = dxhead(bp, blk);
+  e = (struct dxentry*)(hd + 1);
+  nb = 0;
+  if(!p->room[l]){
+    if((nblk = dirgrow(dp)) < 0)
+      panic("dxinsert");
+    nb = bread(dp->dev, bmap(dp, nblk));
+    nh = dxhead(nb, nblk);
+    ne = (struct dxentry*)(nh + 1);
+    if(blk == 0){
+      // the root is full: move its entries to a new
+      // index block, one level down.
+      memmove(ne, e, hd->count * sizeof(*e));
+      nh->count = hd->count;
+      memset(e, 0, hd->count * sizeof(*e));
+      e[0].block = nblk;
+      hd->count = 1;
+      hd->levels++;
+      log_write(bp);
+      brelse(bp);
+      bp = nb;
+      hd = nh;
+      e = ne;
+      nb = 0;
+    } else {
+      // move the upper half to a new block and add
+      // that to the parent.
+      half = hd->count / 2;
+      memmove(ne, e + half, (hd->count - half) * sizeof(*e));
+      nh->count = hd->count - half;
+      memset(e + half, 0, (hd->count - half) * sizeof(*e));
+      hd->count = half;
+      dxinsert(dp, p, l - 1, ne[0].hash, nblk);
+      // an entry at pos == half sorts before ne[0].hash,
+      // so it belongs at the end of the old block.
+      if(pos > half){
+        log_write(bp);
+        brelse(bp);
+        bp = nb;
+        hd = nh;
+        e = ne;
+        nb = 0;
+        pos -= half;
+      }
+    }
+  }
+  memmove(e + pos + 1, e + pos, (hd->count - pos) * sizeof(*e));
+  e[pos].hash = hash;
+  e[pos].block = child;
+  hd->count++;
+  log_write(bp);
+  brelse(bp);
+  if(nb){
+    log_write(nb);
+    brelse(nb);
+  }
+}
+
+// Add (name, inum) to indexed directory dp. Splitting a leaf
+// may not make room for a long name, so try until it does.
+// Returns -1 if the index is full or the disk is.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct dxpath p, q;
+  uint h, leaf, split;
+  int l, nleaf;
+
+  h = dxhash(name, strlen(name));
+  for(;;){
+    dxfind(dp, h, &p);
+    if(diraddto(dp, p.blk[p.levels], name, inum) == 0)
+      return 0;
+    q = p;
+    while(dxnext(dp, &q) == (h|1)){
+      p = q;
+      if(diraddto(dp, p.blk[p.levels], name, inum) == 0)
+        return 0;
+    }
+
+    // The last leaf for h is full, so split it, or if all
+    // its names hash to h, start a continuation leaf after
+    // it. Give up if that would overflow every index block
+    // up to a root at full depth. Otherwise it takes a block
+    // for the new leaf and one for each full index block,
+    // so get them all before changing anything.
+    leaf = p.blk[p.levels];
+    for(l = p.levels - 1; l >= 0 && !p.room[l]; l--)
+      ;
+    if(l < 0 && p.levels == DXMAXLEVEL)
+      return -1;
+    if(dirreserve(dp, p.levels - l) < 0)
+      return -1;
+    nleaf = dirgrow(dp);
+    if((split = dxsplitkey(dp, leaf, h)) == 0)
+      split = h | 1;
+    else
+      dxmove(dp, leaf, nleaf, split);
+    dxinsert(dp, &p, p.levels - 1, split, nleaf);
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint blk, inum, h;
+  struct dxpath p;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  inum = 0;
+  if(dp->flags & I_DIRINDEX){
+    // "." and ".." stay at the start of block 0; others
+    // are in the leaf for their hash.
+    if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+      inum = dirfindin(dp, 0, name, poff);
+    } else {
+      h = dxhash(name, strlen(name));
+      dxfind(dp, h, &p);
+      inum = dirfindin(dp, p.blk[p.levels], name, poff);
+      while(inum == 0 && dxnext(dp, &p) == (h|1))
+        inum = dirfindin(dp, p.blk[p.levels], name, poff);
     }
+  } else {
+    for(blk = 0; blk < dp->size / BSIZE && inum == 0; blk++)
+      inum = dirfindin(dp, blk, name, poff);
   }
 
-  return 0;
+  return inum ? iget(dp->dev, inum) : 0;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
+  int blk;
   struct inode *ip;
 
   // Check that name is not present.
@@ -563,25 +1901,60 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(!(dp->flags & I_DIRINDEX)){
+    // Look for room in the blocks it has.
+    for(blk = 0; blk < dp->size / BSIZE; blk++)
+      if(diraddto(dp, blk, name, inum) == 0)
+        goto done;
+
+    // Once the first block is full, index the directory.
+    // Older directories that grew past it unindexed stay so.
+    if(dp->size != BSIZE){
+      if((blk = dirgrow(dp)) < 0 || diraddto(dp, blk, name, inum) < 0)
+        return -1;
+      goto done;
+    }
+    if(dxconvert(dp) < 0)
+      return -1;
   }
+  if(dxlink(dp, name, inum) < 0)
+    return -1;
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
-
+done:
+  dcacheset(dp, name, inum);
   return 0;
 }
 
+// Remove the entry for name, which dirlookup() found at off,
+// from directory dp. Its space joins the dirent before it.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct buf *bp;
+  struct dirent *de, *prev;
+  uint o;
+
+  bp = bread(dp->dev, bmap(dp, off / BSIZE));
+  off %= BSIZE;
+  prev = 0;
+  for(o = 0; o < off; o += de->reclen)
+    prev = de = dirent(bp->data, o);
+  de = dirent(bp->data, off);
+  if(o != off || de->inum == 0)
+    panic("dirunlink");
+  if(prev)
+    prev->reclen += de->reclen;
+  else
+    de->inum = 0;
+  log_write(bp);
+  brelse(bp);
+  dcacheset(dp, name, 0);
+}
+
 // Paths
 
-// Copy the next path element from path into name.
+// Copy the next path element from path into name, which must
+// have room for DIRSIZ+1 bytes; longer elements are truncated.
 // Return a pointer to the element following the copied one.
 // The returned path has no leading slashes,
 // so the caller can check *path=='\0' to see if the name is the last one.
@@ -607,12 +1980,10 @@ skipelem(char *path, char *name)
   while(*path != '/' && *path != 0)
     path++;
   len = path - s;
-  if(len >= DIRSIZ)
-    memmove(name, s, DIRSIZ);
-  else {
-    memmove(name, s, len);
-    name[len] = 0;
-  }
+  if(len > DIRSIZ)
+    len = DIRSIZ;
+  memmove(name, s, len);
+  name[len] = 0;
   while(*path == '/')
     path++;
   return path;
@@ -620,12 +1991,14 @@ skipelem(char *path, char *name)
 
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
-// path element into name, which must have room for DIRSIZ bytes.
+// path element into name, which must have room for DIRSIZ+1 bytes.
 // Must be called inside a transaction since it calls iput().
 static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct dentry *d;
+  uint inum, seq;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -633,6 +2006,24 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // only directories have dcache entries, so a hit
+    // needn't lock ip to check its type.
+    if(!(nameiparent && *path == '\0') && dcachelookup(ip, name, &inum, &d, &seq)){
+      if(inum == 0){
+        iput(ip);
+        return 0;
+      }
+      next = iget(ip->dev, inum);
+      if(dcachestill(d, seq)){
+        iput(ip);
+        ip = next;
+        continue;
+      }
+      // name may have been unlinked and inum freed before
+      // iget() took its reference; look it up again under
+      // ip's lock.
+      iput(next);
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -643,7 +2034,9 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    dcacheset(ip, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
@@ -660,7 +2053,7 @@ namex(char *path, int nameiparent, char *name)
 struct inode*
 namei(char *path)
 {
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
   return namex(path, 0, name);
 }
 
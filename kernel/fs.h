@@ -24,9 +24,12 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define NLEVEL 3  // single, double and triple indirect
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +38,27 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_* flags
+  uint addrs[NDIRECT+NLEVEL];   // Data block addresses
 };
 
+#define I_EXTENT 0x1    // addrs[] holds extents, not block addresses
+#define I_DIRINDEX 0x2  // directory is indexed by name hash
+
+// An extent-mapped inode's addrs[] holds NIEXTENT extents,
+// each a run of len consecutive blocks starting at start,
+// then in addrs[EXTBLOCK] the address of the first of a
+// chain of extent blocks. Each holds NEXTENT more, and the
+// start of its last slot is the address of the next block,
+// or 0. Unused extents have len 0.
+struct extent {
+  uint start;
+  uint len;
+};
+#define NIEXTENT ((NDIRECT+NLEVEL-1) / 2)
+#define EXTBLOCK (NDIRECT+NLEVEL-1)
+#define NEXTENT (BSIZE / sizeof(struct extent) - 1)
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -50,11 +71,45 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
-// Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+// Directory is a file of blocks, each filled exactly by a
+// sequence of variable-length dirents. A dirent's reclen
+// covers its name, rounded up to 4 bytes, and any free space
+// after it; a dirent with inum 0 is all free space.
+#define DIRSIZ 255  // longest name
 
 struct dirent {
-  ushort inum;
-  char name[DIRSIZ];
+  uint inum;
+  ushort reclen;   // bytes from this dirent to the next
+  uchar namelen;
+  uchar pad;
+  char name[];     // namelen bytes, not NUL-terminated
 };
 
+// Bytes a dirent with a namelen-byte name needs.
+#define DIRENTSZ(namelen) ((sizeof(struct dirent) + (namelen) + 3) & ~3)
+
+// A directory whose first block fills up is indexed
+// (I_DIRINDEX). Block 0 then holds "." and "..", whose
+// reclen hides the rest of the block: a dxhead and the root
+// index. Other index blocks are one free dirent, hiding a
+// dxhead and entries. Each index block's entries point, in
+// increasing order of hash, at the index blocks of the next
+// level or, at the bottom, at leaf blocks of dirents whose
+// name hashes are at least the entry's hash and less than
+// the next entry's.
+struct dxhead {
+  uint levels;  // in the root: levels of index blocks
+  uint count;   // entries in use in this block
+};
+
+struct dxentry {
+  uint hash;    // least name hash below this entry
+  uint block;   // block number within the directory
+};
+
+#define DXROOT (DIRENTSZ(1) + DIRENTSZ(2))  // offset of root dxhead
+#define DXNODE sizeof(struct dirent)         // offset of other dxheads
+#define NDXROOT ((BSIZE - DXROOT - sizeof(struct dxhead)) / sizeof(struct dxentry))
+#define NDXENT ((BSIZE - DXNODE - sizeof(struct dxhead)) / sizeof(struct dxentry))
+#define DXMAXLEVEL 3
+
@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "fs.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -27,7 +28,13 @@ void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+#ifdef ROOT_RAMDISK
+  // don't hand out the pages holding the ramdisk image.
+  freerange(end, (void*)RAMDISK);
+  freerange((void*)(RAMDISK + FSSIZE*BSIZE), (void*)PHYSTOP);
+#else
   freerange(end, (void*)PHYSTOP);
+#endif
 }
 
 void
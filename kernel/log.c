@@ -6,33 +6,72 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "diskstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. A transaction is only closed when there are no FS
+// system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. Usually begin_op() just reserves
+// MAXOPBLOCKS of log space and returns. But if it thinks
+// the log is close to running out, it sleeps until the
+// open transaction has been closed, or the log has been
+// checkpointed. System calls that write more, like write(),
+// reserve what they need with begin_opn()/end_opn(), up to
+// log_maxop() blocks.
+//
+// Transactions are double-buffered. The log daemon, logd,
+// closes the open transaction as soon as no FS system calls
+// are active in it, by copying its blocks into private
+// staging buffers; a new transaction opens at once. logd
+// then appends the closed transaction to the log, while new
+// system calls modify the cached blocks on behalf of the next
+// transaction. end_op() does not wait for the commit;
+// log_sync() waits until the caller's updates are on disk.
+//
+// Committed blocks are not written to their home locations
+// right away; they stay pinned in the buffer cache, so a
+// block updated by many transactions is written home once.
+// When the log fills, logd checkpoints: with no FS system
+// calls active, the cache holds exactly the committed state,
+// so logd installs every pinned block from the cache, then
+// empties the log.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   tail block, containing the sequence # of the first transaction
+//     and the log's salt
+//   header block, containing magic, seq, checksum and block #s
+//     for block A, B, C
 //   block A
 //   block B
 //   block C
+//   header block of the next transaction (seq+1) ...
 //   ...
-// Log appends are synchronous.
+// Recovery replays consecutive transactions whose headers carry
+// the magic number and the expected sequence numbers, and whose
+// checksums match. Log appends are synchronous.
+//
+// After a checkpoint the log is reused from the start, so what
+// follows the last transaction is stale: earlier headers, or
+// logged blocks, which may hold file data a user chose. The
+// checksum covers the header and its blocks and is seeded with
+// a salt that changes every boot and that users can't read, so
+// a stale block can't pass for the next header.
+
+#define LOGMAGIC 0x474f4c78  // "xLOG"
 
-// Contents of the header block, used for both the on-disk header block
+// Contents of a header block, used for both the on-disk header blocks
 // and to keep track in memory of logged block# before commit.
 struct logheader {
+  uint magic;
+  uint seq;
+  uint sum;   // logsum() of the header and its blocks
   int n;
   int block[LOGSIZE];
 };
@@ -42,168 +81,429 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they have reserved.
+  int closing;     // logd is staging or checkpointing, please wait.
+  int ckpt;        // the log is full; logd should checkpoint.
+  int head;        // where the open transaction will go in the log.
   int dev;
-  struct logheader lh;
+  uint seq;        // sequence number of the open transaction.
+  uint salt;       // seeds header checksums.
+  uint durable;    // transactions up to this one are on disk.
+  uint ncommit;    // transactions committed since boot.
+  uint64 nlogged;  // blocks they wrote to the log.
+  uint nckpt;      // checkpoints since boot.
+  uint64 ninstalled; // blocks they installed.
+  struct logheader lh;  // the open transaction.
+  struct logheader clh; // the closed transaction, owned by logd.
 };
 struct log log;
 
+// logd's copies of the closed transaction's blocks, so that
+// the next transaction can modify the cached originals.
+static struct buf logbuf[LOGSIZE];
+
+// cached blocks pinned by the log: those of the open and
+// closed transactions and of committed ones not yet installed.
+static struct buf *logged[MAXLOG];
+static int nlogged;
+
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
+  if (sb->nlog > MAXLOG || sb->nlog < 2*MAXOPBLOCKS + 2)
+    panic("initlog: bad log size");
+
   initlock(&log.lock, "log");
+  for (int i = 0; i < LOGSIZE; i++)
+    initsleeplock(&logbuf[i].lock, "logbuf");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  kthread("logd", logd);
 }
 
-// Copy committed blocks from log to their home location
+// Read or write logbuf[0..n). logbuf[i] is block addr[i],
+// or the block at log position pos+i if addr is 0.
 static void
-install_trans(void)
+rw_staged(int n, int *addr, int pos, int write)
 {
-  int tail;
+  struct buf *b[MAXIOBLOCKS];
+  int tail, i, m;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < n; tail += m) {
+    for (m = 0; m < MAXIOBLOCKS && tail+m < n; m++) {
+      b[m] = &logbuf[tail+m];
+      acquiresleep(&b[m]->lock);
+      b[m]->dev = log.dev;
+      b[m]->blockno = addr ? addr[tail+m] : log.start+1+pos+tail+m;
+    }
+    brwv(b, m, write, 1);
+    for (i = 0; i < m; i++)
+      releasesleep(&b[i]->lock);
+  }
+}
+
+#define MIX(s, x) (((s) ^ (x)) * 16777619)  // FNV-1a, a word at a time
+
+// Checksum header h, less its sum, and its blocks, which
+// are in logbuf.
+static uint
+logsum(struct logheader *h)
+{
+  uint s, *w;
+  int i, j;
+
+  s = MIX(2166136261, log.salt);
+  s = MIX(s, h->magic);
+  s = MIX(s, h->seq);
+  s = MIX(s, h->n);
+  for (i = 0; i < h->n; i++)
+    s = MIX(s, h->block[i]);
+  for (i = 0; i < h->n; i++) {
+    w = (uint *) logbuf[i].data;
+    for (j = 0; j < BSIZE / sizeof(uint); j++)
+      s = MIX(s, w[j]);
   }
+  return s;
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the header at log position pos.
 static void
-read_head(void)
+read_head(int pos, struct logheader *h)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, log.start+1+pos);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  h->magic = lh->magic;
+  h->seq = lh->seq;
+  h->sum = lh->sum;
+  h->n = lh->n;
+  for (i = 0; i < h->n && i < LOGSIZE; i++) {
+    h->block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write a header to log position pos.
 // This is the true point at which the
-// current transaction commits.
+// transaction commits.
 static void
-write_head(void)
+write_head(int pos, struct logheader *h)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bgetz(log.dev, log.start+1+pos);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->magic = h->magic;
+  hb->seq = h->seq;
+  hb->sum = h->sum;
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
-  bwrite(buf);
+  brwv(&buf, 1, 1, 1);
   brelse(buf);
 }
 
+// Record that the log now starts with transaction seq,
+// discarding the transactions before it.
+static void
+write_tail(uint seq)
+{
+  struct buf *buf = bgetz(log.dev, log.start);
+  ((uint *) buf->data)[0] = seq;
+  ((uint *) buf->data)[1] = log.salt;
+  brwv(&buf, 1, 1, 1);
+  brelse(buf);
+}
+
+// Replay every committed transaction, oldest first, then
+// empty the log.
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *buf;
+  uint seq;
+  int pos;
+
+  buf = bread(log.dev, log.start);
+  seq = ((uint *) buf->data)[0];
+  log.salt = ((uint *) buf->data)[1];
+  brelse(buf);
+  if (seq == 0)  // a fresh log
+    seq = 1;
+
+  for (pos = 0; pos < log.size - 1; pos += log.clh.n + 1) {
+    read_head(pos, &log.clh);
+    if (log.clh.magic != LOGMAGIC || log.clh.seq != seq ||
+        log.clh.n < 1 || log.clh.n > LOGSIZE ||
+        pos + 1 + log.clh.n > log.size - 1)
+      break;
+    rw_staged(log.clh.n, 0, pos + 1, 0); // read the logged blocks
+    if (logsum(&log.clh) != log.clh.sum)
+      break;
+    rw_staged(log.clh.n, log.clh.block, 0, 1); // copy them home
+    seq++;
+  }
+  log.clh.n = 0;
+  log.seq = seq;
+  log.durable = seq - 1;
+  log.head = 0;
+  // a new salt, so that nothing written to the log before
+  // now can check out.
+  log.salt = log.salt * 1103515245 + (uint) r_time();
+  write_tail(seq); // clear the log
 }
 
-// called at the start of each FS system call.
+// The most log blocks one FS system call may reserve;
+// half a transaction, so that two such calls can share it.
+int
+log_maxop(void)
+{
+  int n = log.size - 2;
+  if (n > LOGSIZE)
+    n = LOGSIZE;
+  return n / 2;
+}
+
+// The most blocks the open transaction may hold: it must
+// fit in a header, and in the log after the closed ones.
+static int
+log_room(void)
+{
+  int room = log.size - 1 - log.head - 1;
+  return room < LOGSIZE ? room : LOGSIZE;
+}
+
+// called at the start of an FS system call that may
+// write up to n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n < 1 || n > log_maxop())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + log.reserved + n > log_room()){
+      // this op might exhaust log space; wait for logd to
+      // close the open transaction, and, if the log itself
+      // is full, to checkpoint.
+      if(log.lh.n + log.reserved + n <= LOGSIZE){
+        log.ckpt = 1;
+        wakeup(&log.lh);
+      }
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of an FS system call that
+// called begin_opn(n).
+// if this was the last outstanding operation, logd
+// closes and commits the transaction.
+void
+end_opn(int n)
+{
+  acquire(&log.lock);
+  log.outstanding -= 1;
+  log.reserved -= n;
+  if(log.closing)
+    panic("log.closing");
+  if(log.outstanding == 0)
+    wakeup(&log.lh);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  release(&log.lock);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opn(MAXOPBLOCKS);
+}
 
+// Copy out the commit and checkpoint counters.
+void
+log_stat(struct diskstat *st)
+{
   acquire(&log.lock);
-  log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  st->ncommit = log.ncommit;
+  st->nlogged = log.nlogged;
+  st->nckpt = log.nckpt;
+  st->ninstalled = log.ninstalled;
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
+// Wait until the updates of every FS system call that
+// has finished are on disk. Must not be called inside
+// a transaction.
+void
+log_sync(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  // an empty open transaction holds none of our updates.
+  target = log.lh.n > 0 ? log.seq : log.seq - 1;
+  while(log.durable < target)
+    sleep(&log.durable, &log.lock);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Copy the open transaction's blocks from the cache to
+// the staging buffers. No FS system calls are active, and
+// begin_op() waits while log.closing is set, so the
+// cached blocks don't change underneath us.
 static void
-write_log(void)
+stage_trans(void)
 {
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(logbuf[tail].data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Append the closed transaction, at log position pos:
+// first the staged blocks, then the header.
+// The log blocks are contiguous on disk, so each batch
+// of MAXIOBLOCKS goes out as a single disk request.
 static void
-commit()
-{
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+commit(int pos)
+{
+  log.clh.magic = LOGMAGIC;
+  log.clh.sum = logsum(&log.clh);
+  rw_staged(log.clh.n, 0, pos + 1, 1); // Write staged blocks to log
+  write_head(pos, &log.clh); // Write header to disk -- the real commit
+
+  acquire(&log.lock);
+  log.durable = log.clh.seq;
+  log.ncommit++;
+  log.nlogged += log.clh.n;
+  wakeup(&log.durable);
+  release(&log.lock);
+  log.clh.n = 0;
+}
+
+// Install every logged block at its home location, in
+// block order so that neighbours merge into one request,
+// then empty the log. Called by logd with log.closing set
+// and no transaction open, so each cached block holds its
+// last committed contents.
+static void
+checkpoint(void)
+{
+  struct buf *b;
+  int i, j, m;
+
+  for (i = 1; i < nlogged; i++) {
+    b = logged[i];
+    for (j = i; j > 0 && logged[j-1]->blockno > b->blockno; j--)
+      logged[j] = logged[j-1];
+    logged[j] = b;
+  }
+  for (i = 0; i < nlogged; i += m) {
+    m = nlogged - i < MAXIOBLOCKS ? nlogged - i : MAXIOBLOCKS;
+    for (j = 0; j < m; j++)
+      acquiresleep(&logged[i+j]->lock);
+    brwv(&logged[i], m, 1, 0);
+    for (j = 0; j < m; j++)
+      releasesleep(&logged[i+j]->lock);
+  }
+  write_tail(log.seq);
+
+  acquire(&log.lock);
+  for (i = 0; i < nlogged; i++) {
+    logged[i]->logged = 0;
+    bunpin(logged[i]);
+  }
+  log.nckpt++;
+  log.ninstalled += nlogged;
+  nlogged = 0;
+  log.head = 0;
+  log.ckpt = 0;
+  release(&log.lock);
+}
+
+// The log daemon, a kernel thread. Closes the open transaction
+// whenever it has updates and no FS system calls are active
+// in it, then commits it. Checkpoints when asked to.
+static void
+logd(void)
+{
+  int pos, ckpt;
+
+  acquire(&log.lock);
+  for(;;){
+    if(log.outstanding > 0 || (log.lh.n == 0 && !log.ckpt)){
+      sleep(&log.lh, &log.lock);
+      continue;
+    }
+
+    log.closing = 1;
+    ckpt = log.ckpt;
+    release(&log.lock);
+    stage_trans();
+    acquire(&log.lock);
+    pos = log.head;
+    if(log.lh.n > 0){
+      log.clh = log.lh;
+      log.clh.seq = log.seq;
+      log.head += log.lh.n + 1;
+      log.lh.n = 0;
+      log.seq++;
+    }
+    if(!ckpt){
+      log.closing = 0;
+      wakeup(&log);
+    }
+    release(&log.lock);
+
+    if(log.clh.n > 0)
+      commit(pos);
+
+    if(ckpt){
+      checkpoint();
+      acquire(&log.lock);
+      log.closing = 0;
+      wakeup(&log);
+      release(&log.lock);
+    }
+
+    acquire(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// logd will copy the block into the log when the transaction closes,
+// and install it when the log is next checkpointed.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +515,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= LOGSIZE)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -226,10 +526,12 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
-    bpin(b);
+  if (i == log.lh.n)   // Add new block to log?
     log.lh.n++;
+  if (!b->logged) {  // already pinned by an earlier transaction?
+    b->logged = 1;
+    bpin(b);
+    logged[nlogged++] = b;
   }
   release(&log.lock);
 }
-
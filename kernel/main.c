@@ -27,7 +27,11 @@ main()
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+#ifdef ROOT_RAMDISK
+    ramdiskinit();   // fs.img loaded by qemu -initrd
+#else
     virtio_disk_init(); // emulated hard disk
+#endif
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
@@ -10,11 +10,13 @@
 // 10001000 -- virtio disk 
 // 80000000 -- boot ROM jumps here in machine mode
 //             -kernel loads the kernel here
+// 84000000 -- -initrd loads the ramdisk image here
 // unused RAM after 80000000.
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
+// RAMDISK -- fs.img, if built with RAMDISK=1
 // PHYSTOP -- end RAM used by the kernel
 
 // qemu puts UART registers here in physical memory.
@@ -47,6 +49,10 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// qemu loads -initrd halfway into RAM on machines with
+// less than 256MB of it.
+#define RAMDISK (KERNBASE + 64*1024*1024)
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -2,12 +2,14 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // i-nodes kept in the cache; more are allocated on demand
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
-#define MAXPATH      128   // maximum file path name
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes
+#define LOGSIZE      252  // max data blocks in one log transaction
+#define MAXLOG       (LOGSIZE*3)  // max blocks in on-disk log; mkfs -l picks the size
+#define MAXIOBLOCKS  8   // max blocks merged into one disk request
+#define NBUF         (MAXLOG+MAXOPBLOCKS*3)  // size of disk block cache
+#define FSSIZE       20000  // size of file system in blocks
+#define MAXPATH      512   // maximum file path name
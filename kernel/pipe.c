@@ -7,18 +7,54 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "pipestat.h"
+#include "poll.h"
+#include "waitq.h"
+#include "uio.h"
 
-#define PIPESIZE 512
+#define PIPEMAXPAGES 16  // largest buffer, in pages
 
+// The buffer is npage kalloc()ed pages, a power of two so
+// that nread and nwrite may wrap. A sleeping reader is woken
+// once hiwat bytes are buffered, and a sleeping writer once
+// no more than lowat are.
+//
+// splice() copies to and from the buffer without holding
+// the lock, so it marks the bytes it is using with rbusy or
+// wbusy; other readers or writers wait for it.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES];
+  uint npage;
+  uint size;      // npage * PGSIZE
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  uint hiwat;
+  uint lowat;
+  int rbusy;      // splice() is reading from the buffer
+  int wbusy;      // splice() is writing to the buffer
+  struct waitq rq;  // poll()s waiting to read
+  struct waitq wq;  // poll()s waiting to write
 };
 
+// Updated with atomic adds, not under a lock, since every
+// pipe read and write counts and they can't share one lock.
+struct pipestat pstat;
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// The watermarks that make a pipe behave like one that
+// wakes its peer after every read or write.
+static void
+pipemarks(struct pipe *pi)
+{
+  pi->hiwat = 1;
+  pi->lowat = pi->size - 1;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,10 +66,19 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  if((pi->page[0] = kalloc()) == 0)
+    goto bad;
+  pi->npage = 1;
+  pi->size = PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
+  pi->rq.head = 0;
+  pi->wq.head = 0;
+  pipemarks(pi);
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -55,73 +100,558 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < pi->npage; i++)
+    kfree(pi->page[i]);
+  kfree((char*)pi);
+}
+
+// Wake readers, and poll()s waiting to read, when there is
+// now enough to read; writers when there is room to write.
+// Caller holds pi->lock.
+static void
+pipewakeread(struct pipe *pi)
+{
+  wakeup(&pi->nread);
+  pollwake(&pi->rq);
+}
+
+static void
+pipewakewrite(struct pipe *pi)
+{
+  wakeup(&pi->nwrite);
+  pollwake(&pi->wq);
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
-    wakeup(&pi->nread);
+    pipewakeread(pi);
   } else {
     pi->readopen = 0;
-    wakeup(&pi->nwrite);
+    pipewakewrite(pi);
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// The address of byte off of the buffer, and in *n how
+// many bytes follow it in the same page.
+static char*
+pipebuf(struct pipe *pi, uint off, uint *n)
+{
+  off %= pi->size;
+  *n = PGSIZE - off % PGSIZE;
+  return pi->page[off / PGSIZE] + off % PGSIZE;
+}
+
+static void
+pipecount(uint64 *c, int n)
+{
+  __atomic_fetch_add(c, n, __ATOMIC_RELAXED);
+}
+
+// Write the cnt user buffers in iov to pi, in order, waiting
+// for room unless flags has O_NONBLOCK. Returns the number of
+// bytes written, or -EAGAIN if none could be without waiting.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewritev(struct pipe *pi, struct iovec *iov, int cnt, int flags)
 {
-  int i;
-  char ch;
+  int i, k, tot;
+  uint m, len, was;
+  uint64 addr;
+  char *p;
   struct proc *pr = myproc();
 
+  tot = 0;
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
+  for(k = 0; k < cnt; k++){
+    addr = (uint64)iov[k].base;
+    for(i = 0; i < iov[k].len; i += m, tot += m){
+      while(pi->nwrite == pi->nread + pi->size || pi->wbusy){  //DOC: pipewrite-full
+        if(pi->readopen == 0 || pr->killed){
+          release(&pi->lock);
+          return -1;
+        }
+        if(flags & O_NONBLOCK){
+          release(&pi->lock);
+          pipecount(&pstat.ncopied, tot);
+          return tot > 0 ? tot : -EAGAIN;
+        }
+        sleep(&pi->nwrite, &pi->lock);
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      // copy as much as fits in this page of the buffer.
+      p = pipebuf(pi, pi->nwrite, &len);
+      m = min(iov[k].len - i, pi->size - (pi->nwrite - pi->nread));
+      m = min(m, len);
+      if(copyin(pr->pagetable, p, addr + i, m) == -1)
+        goto out;
+      was = pi->nwrite - pi->nread;
+      pi->nwrite += m;
+      if(was < pi->hiwat && was + m >= pi->hiwat)
+        pipewakeread(pi);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-      break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
   }
-  wakeup(&pi->nread);
+out:
   release(&pi->lock);
-  return i;
+  pipecount(&pstat.ncopied, tot);
+  return tot;
 }
 
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int flags)
 {
-  int i;
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return pipewritev(pi, &iov, 1, flags);
+}
+
+// Read from pi into the cnt user buffers in iov, in order,
+// waiting for hiwat bytes, or end of file, unless flags has
+// O_NONBLOCK: then take what there is, or return -EAGAIN.
+int
+pipereadv(struct pipe *pi, struct iovec *iov, int cnt, int flags)
+{
+  int i, k, tot;
+  uint m, len, was;
+  uint64 addr;
+  char *p;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nwrite - pi->nread < pi->hiwat && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
+    if(flags & O_NONBLOCK){
+      if(pi->nwrite != pi->nread && !pi->rbusy)
+        break;
+      release(&pi->lock);
+      return -EAGAIN;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  tot = 0;
+  for(k = 0; k < cnt && pi->nread != pi->nwrite; k++){
+    addr = (uint64)iov[k].base;
+    for(i = 0; i < iov[k].len && pi->nread != pi->nwrite; i += m, tot += m){  //DOC: piperead-copy
+      p = pipebuf(pi, pi->nread, &len);
+      m = min(iov[k].len - i, pi->nwrite - pi->nread);
+      m = min(m, len);
+      if(copyout(pr->pagetable, addr + i, p, m) == -1)
+        goto out;
+      was = pi->nwrite - pi->nread;
+      pi->nread += m;
+      if(was > pi->lowat && was - m <= pi->lowat)
+        pipewakewrite(pi);  //DOC: piperead-wakeup
+    }
+  }
+out:
+  release(&pi->lock);
+  pipecount(&pstat.ncopied, tot);
+  return tot;
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n, int flags)
+{
+  struct iovec iov;
+
+  iov.base = (void*)addr;
+  iov.len = n;
+  return pipereadv(pi, &iov, 1, flags);
+}
+
+// Resize pi's buffer to hold at least n bytes, rounded up to
+// a power of two pages. This resets the watermarks.
+static int
+piperesize(struct pipe *pi, int n)
+{
+  char *page[PIPEMAXPAGES];
+  uint npage, avail, off, m, len;
+  char *p;
+  int i;
+
+  if(n < 0 || n > PIPEMAXPAGES * PGSIZE)
+    return -1;
+  for(npage = 1; npage * PGSIZE < n; npage *= 2)
+    ;
+  for(i = 0; i < npage; i++){
+    if((page[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(page[i]);
+      return -1;
+    }
+  }
+
+  acquire(&pi->lock);
+  while(pi->rbusy || pi->wbusy)
+    sleep(pi->rbusy ? &pi->nread : &pi->nwrite, &pi->lock);
+  avail = pi->nwrite - pi->nread;
+  if(avail > npage * PGSIZE){
+    release(&pi->lock);
+    for(i = 0; i < npage; i++)
+      kfree(page[i]);
+    return -1;
+  }
+  // move the buffered bytes to the start of the new pages.
+  for(off = 0; off < avail; off += m){
+    p = pipebuf(pi, pi->nread + off, &len);
+    m = min(avail - off, len);
+    m = min(m, PGSIZE - off % PGSIZE);
+    memmove(page[off / PGSIZE] + off % PGSIZE, p, m);
+  }
+  for(i = 0; i < pi->npage; i++)
+    kfree(pi->page[i]);
+  memmove(pi->page, page, sizeof(page));
+  pi->npage = npage;
+  pi->size = npage * PGSIZE;
+  pi->nread = 0;
+  pi->nwrite = avail;
+  pipemarks(pi);
+  pipewakeread(pi);
+  pipewakewrite(pi);
+  release(&pi->lock);
+  return pi->size;
+}
+
+// poll() on an end of a pipe. Like the sleeping reader and
+// writer, it counts the pipe readable once hiwat bytes are
+// buffered and writable once no more than lowat are, so
+// that a poller is woken when they would be.
+int
+pipepoll(struct pipe *pi, int events, struct polltable *t)
+{
+  uint avail;
+  int r;
+
+  r = 0;
+  acquire(&pi->lock);
+  avail = pi->nwrite - pi->nread;
+  if(events & POLLIN){
+    if(avail >= pi->hiwat || !pi->writeopen)
+      r |= POLLIN;
+    if(!pi->writeopen)
+      r |= POLLHUP;
+    else if(!r)
+      pollwait(&pi->rq, &pi->lock, t);
+  }
+  if(events & POLLOUT){
+    if(avail <= pi->lowat || !pi->readopen)
+      r |= POLLOUT;
+    if(!pi->readopen)
+      r |= POLLHUP;
+    else if(!r)
+      pollwait(&pi->wq, &pi->lock, t);
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// fcntl() on either end of a pipe.
+int
+pipefcntl(struct pipe *pi, int cmd, int arg)
+{
+  int r;
+
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pi->size;
+  case F_SETPIPE_SZ:
+    return piperesize(pi, arg);
+  case F_SETPIPE_HIWAT:
+  case F_SETPIPE_LOWAT:
+    r = -1;
+    acquire(&pi->lock);
+    if(cmd == F_SETPIPE_HIWAT && arg >= 1 && arg <= pi->size){
+      pi->hiwat = arg;
+      r = 0;
+    } else if(cmd == F_SETPIPE_LOWAT && arg >= 0 && arg < pi->size){
+      pi->lowat = arg;
+      r = 0;
+    }
+    // sleepers may now be past their watermark.
+    pipewakeread(pi);
+    pipewakewrite(pi);
+    release(&pi->lock);
+    return r;
+  }
+  return -1;
+}
+
+// Wait for bytes to read past the first off in pi, with no
+// other splice() reading, and claim them: returns how many
+// (up to n, and to the end of a page of the buffer) the
+// caller may copy from *p without holding pi->lock, before
+// calling piperend(). Returns 0 at end of file or, if !wait,
+// when there is nothing to read; -1 if the caller is killed.
+static int
+piperbegin(struct pipe *pi, uint off, int n, int wait, char **p)
+{
+  uint len, m;
+
+  acquire(&pi->lock);
+  while((pi->nwrite - pi->nread < pi->hiwat && pi->writeopen) || pi->rbusy){
+    if(myproc()->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    if(!wait)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    sleep(&pi->nread, &pi->lock);
+  }
+  if(pi->rbusy || pi->nwrite - pi->nread <= off){
+    release(&pi->lock);
+    return 0;
+  }
+  pi->rbusy = 1;
+  *p = pipebuf(pi, pi->nread + off, &len);
+  m = min(n, pi->nwrite - pi->nread - off);
+  m = min(m, len);
+  release(&pi->lock);
+  return m;
+}
+
+// Finish piperbegin(), consuming m of the bytes.
+static void
+piperend(struct pipe *pi, int m)
+{
+  uint was;
+
+  acquire(&pi->lock);
+  was = pi->nwrite - pi->nread;
+  pi->nread += m;
+  pi->rbusy = 0;
+  if(m > 0 && was > pi->lowat && was - m <= pi->lowat)
+    pipewakewrite(pi);
+  wakeup(&pi->nread);
+  release(&pi->lock);
+}
+
+// Wait for room in pi, with no other splice() writing, and
+// claim it: returns how many bytes (up to n, and to the end
+// of a page of the buffer) the caller may copy to *p without
+// holding pi->lock, before calling pipewend(). Returns 0 if
+// the buffer is full and !wait; -1 if the read side is
+// closed or the caller is killed.
+static int
+pipewbegin(struct pipe *pi, int n, int wait, char **p)
+{
+  uint len, m;
+
+  acquire(&pi->lock);
+  while(pi->nwrite == pi->nread + pi->size || pi->wbusy){
+    if(pi->readopen == 0 || myproc()->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    if(!wait){
+      release(&pi->lock);
+      return 0;
+    }
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  pi->wbusy = 1;
+  *p = pipebuf(pi, pi->nwrite, &len);
+  m = min(n, pi->size - (pi->nwrite - pi->nread));
+  m = min(m, len);
+  release(&pi->lock);
+  return m;
+}
+
+// Wait, without claiming it, for room in pi. Returns -1 if
+// the caller is killed.
+static int
+pipewaitroom(struct pipe *pi)
+{
+  acquire(&pi->lock);
+  while((pi->nwrite == pi->nread + pi->size || pi->wbusy) && pi->readopen){
+    if(myproc()->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  release(&pi->lock);
+  return 0;
+}
+
+// Finish pipewbegin(), having written m bytes.
+static void
+pipewend(struct pipe *pi, int m)
+{
+  uint was;
+
+  acquire(&pi->lock);
+  was = pi->nwrite - pi->nread;
+  pi->nwrite += m;
+  pi->wbusy = 0;
+  if(m > 0 && was < pi->hiwat && was + m >= pi->hiwat)
+    pipewakeread(pi);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
+
+// Move up to n bytes from file in to file out, at least one
+// of them a pipe, without copying them through user space:
+// the other end's data goes straight between the pipe's
+// buffer and the buffer cache. With tee, both are pipes and
+// in keeps the bytes. Waits only until it can move some, and
+// never while holding one pipe's bytes, so splices between
+// two pipes in opposite directions can't deadlock. Returns
+// fewer than n if out fills up.
+int
+pipesplice(struct file *in, struct file *out, int n, int tee)
+{
+  int tot, m, r, wait;
+  char *src, *dst;
+
+  if(!in->readable || !out->writable || n < 0)
+    return -1;
+  if(in->type != FD_PIPE && out->type != FD_PIPE)
+    return -1;
+  if(in->type != FD_PIPE && in->type != FD_INODE)
+    return -1;
+  if(out->type != FD_PIPE && out->type != FD_INODE)
+    return -1;
+  if(tee && (in->type != FD_PIPE || out->type != FD_PIPE))
+    return -1;
+  if(in->type == FD_PIPE && out->type == FD_PIPE && in->pipe == out->pipe)
+    return -1;
+
+  for(tot = 0; tot < n; tot += r){
+    wait = tot == 0;
+    if(in->type != FD_PIPE){
+      if((m = pipewbegin(out->pipe, n - tot, wait, &dst)) <= 0)
+        r = m;
+      else {
+        r = fileiread(in, 0, (uint64)dst, m);
+        pipewend(out->pipe, r > 0 ? r : 0);
+      }
+    } else if((m = piperbegin(in->pipe, tee ? tot : 0, n - tot, wait, &src)) <= 0){
+      r = m;
+    } else if(out->type != FD_PIPE){
+      r = fileiwrite(out, 0, (uint64)src, m);
+      piperend(in->pipe, r > 0 ? r : 0);
+      if(r > 0 && r < m){
+        // the disk is full.
+        tot += r;
+        break;
+      }
+    } else {
+      // take only the room out has now; if it has none, let
+      // go of in's bytes before waiting for some.
+      if((r = pipewbegin(out->pipe, m, 0, &dst)) > 0){
+        memmove(dst, src, r);
+        pipewend(out->pipe, r);
+      }
+      piperend(in->pipe, tee || r < 0 ? 0 : r);
+      if(r == 0 && wait){
+        if(pipewaitroom(out->pipe) < 0)
+          return -1;
+        continue;
+      }
+    }
+    if(r <= 0){
+      if(r < 0 && tot == 0)
+        return -1;
       break;
+    }
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pipecount(&pstat.nspliced, tot);
+  return tot;
+}
+
+// Give the whole page at user address va to pi, if the next
+// page of its buffer is free: swap the two pages instead of
+// copying. Returns PGSIZE if it did, else 0; -1 if the read
+// side is closed or the caller is killed.
+static int
+pipegift(struct pipe *pi, uint64 va)
+{
+  struct proc *pr = myproc();
+  char *old;
+  uint64 pa;
+  uint len;
+
+  acquire(&pi->lock);
+  while(pi->nwrite == pi->nread + pi->size || pi->wbusy){
+    if(pi->readopen == 0 || pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->nwrite == pi->nread){
+    // empty: start over at a page boundary.
+    pi->nwrite = pi->nread = PGROUNDUP(pi->nwrite);
+  }
+  if(pi->nwrite % PGSIZE != 0 || pi->size - (pi->nwrite - pi->nread) < PGSIZE){
+    release(&pi->lock);
+    return 0;
+  }
+  old = pipebuf(pi, pi->nwrite, &len);
+  // the user gets this page; don't let it see old pipe data.
+  memset(old, 0, PGSIZE);
+  if((pa = uvmremap(pr->pagetable, va, (uint64)old)) == 0){
+    release(&pi->lock);
+    return 0;
+  }
+  pi->page[pi->nwrite % pi->size / PGSIZE] = (char*)pa;
+  if(pi->nwrite - pi->nread < pi->hiwat && pi->nwrite - pi->nread + PGSIZE >= pi->hiwat)
+    pipewakeread(pi);
+  pi->nwrite += PGSIZE;
   release(&pi->lock);
-  return i;
+  return PGSIZE;
+}
+
+// Write n bytes at user address addr to pi, giving it whole
+// pages, when it has room for them, instead of copying. The
+// caller must not use the given pages' contents afterwards:
+// they are replaced by zeroed pages.
+int
+pipevmsplice(struct pipe *pi, uint64 addr, int n)
+{
+  int tot, m, gifted;
+
+  gifted = 0;
+  for(tot = 0; tot < n; tot += m){
+    m = 0;
+    if((addr + tot) % PGSIZE == 0 && n - tot >= PGSIZE){
+      if((m = pipegift(pi, addr + tot)) < 0)
+        break;
+      gifted += m;
+    }
+    if(m == 0){
+      // copy up to the next page boundary.
+      m = min(n - tot, PGSIZE - (addr + tot) % PGSIZE);
+      if((m = pipewrite(pi, addr + tot, m, 0)) <= 0)
+        break;
+    }
+  }
+  pipecount(&pstat.ngifted, gifted);
+  return tot > 0 ? tot : -1;
+}
+
+// Copy out the pipe data counters. Each is read atomically,
+// but a pipe may be counted in one and not yet in another.
+void
+pipestats(struct pipestat *st)
+{
+  st->ncopied = __atomic_load_n(&pstat.ncopied, __ATOMIC_RELAXED);
+  st->nspliced = __atomic_load_n(&pstat.nspliced, __ATOMIC_RELAXED);
+  st->ngifted = __atomic_load_n(&pstat.ngifted, __ATOMIC_RELAXED);
 }
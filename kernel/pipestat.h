@@ -0,0 +1,7 @@
+// Pipe data counters, reported by the pipestat() system call.
+
+struct pipestat {
+  uint64 ncopied;  // bytes copied by read() and write()
+  uint64 nspliced; // bytes moved by splice() and tee()
+  uint64 ngifted;  // bytes of whole pages given by vmsplice()
+};
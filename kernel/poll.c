@@ -0,0 +1,167 @@
+//
+// poll(): wait until one of several files is ready.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "waitq.h"
+
+// poll() calls with a timeout, woken by polltick().
+// Protected by tickslock.
+static struct polltable *timed;
+
+// Add t to q, whose object's lock lk the caller holds, so
+// that t is woken when the object changes.
+void
+pollwait(struct waitq *q, struct spinlock *lk, struct polltable *t)
+{
+  struct pollent *e;
+
+  if(t == 0)
+    return;
+  if(t->nent >= NOFILE)
+    panic("pollwait");
+  e = &t->ent[t->nent++];
+  e->t = t;
+  e->q = q;
+  e->lk = lk;
+  e->next = q->head;
+  q->head = e;
+}
+
+// Wake the poll() calls waiting on q.
+// Caller holds the lock of q's object.
+void
+pollwake(struct waitq *q)
+{
+  struct pollent *e;
+
+  for(e = q->head; e; e = e->next){
+    acquire(&e->t->lock);
+    e->t->woken = 1;
+    wakeup(e->t);
+    release(&e->t->lock);
+  }
+}
+
+// Take t's entries off their queues.
+static void
+pollremove(struct polltable *t)
+{
+  struct pollent *e, **pp;
+  int i;
+
+  for(i = 0; i < t->nent; i++){
+    e = &t->ent[i];
+    acquire(e->lk);
+    for(pp = &e->q->head; *pp; pp = &(*pp)->next){
+      if(*pp == e){
+        *pp = e->next;
+        break;
+      }
+    }
+    release(e->lk);
+  }
+  t->nent = 0;
+}
+
+// Called by clockintr() with tickslock held.
+void
+polltick(void)
+{
+  struct polltable *t;
+
+  for(t = timed; t; t = t->tnext)
+    if((int)(ticks - t->deadline) >= 0)
+      wakeup(t);
+}
+
+static void
+polltimed(struct polltable *t, int add)
+{
+  struct polltable **pp;
+
+  acquire(&tickslock);
+  if(add){
+    t->tnext = timed;
+    timed = t;
+  } else {
+    for(pp = &timed; *pp; pp = &(*pp)->tnext){
+      if(*pp == t){
+        *pp = t->tnext;
+        break;
+      }
+    }
+  }
+  release(&tickslock);
+}
+
+// Check nfds struct pollfds at user address addr, waiting
+// until at least one is ready, or for timeout ticks if
+// timeout isn't negative. Returns how many are ready.
+int
+poll(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct polltable t;
+  struct pollfd pfd;
+  struct file *f;
+  int i, n, first;
+
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  initlock(&t.lock, "poll");
+  t.nent = 0;
+  t.deadline = ticks + timeout;
+  if(timeout > 0)
+    polltimed(&t, 1);
+
+  // the first pass puts t on the queue of each file that
+  // isn't ready; later ones just look again.
+  for(first = 1; ; first = 0){
+    t.woken = 0;
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      if(copyin(p->pagetable, (char*)&pfd, addr + i*sizeof(pfd), sizeof(pfd)) < 0){
+        n = -1;
+        goto out;
+      }
+      if(pfd.fd < 0 || pfd.fd >= NOFILE || (f = p->ofile[pfd.fd]) == 0)
+        pfd.revents = POLLNVAL;
+      else
+        pfd.revents = filepoll(f, pfd.events, first && n == 0 ? &t : 0);
+      if(pfd.revents)
+        n++;
+      if(copyout(p->pagetable, addr + i*sizeof(pfd), (char*)&pfd, sizeof(pfd)) < 0){
+        n = -1;
+        goto out;
+      }
+    }
+    if(n > 0 || timeout == 0)
+      break;
+    if(timeout > 0 && (int)(ticks - t.deadline) >= 0)
+      break;
+    acquire(&t.lock);
+    if(p->killed){
+      release(&t.lock);
+      n = -1;
+      break;
+    }
+    if(!t.woken)
+      sleep(&t, &t.lock);
+    release(&t.lock);
+  }
+out:
+  if(timeout > 0)
+    polltimed(&t, 0);
+  pollremove(&t);
+  return n;
+}
@@ -0,0 +1,12 @@
+// poll() requests and results.
+
+struct pollfd {
+  int fd;
+  short events;   // POLLIN and POLLOUT: what to wait for
+  short revents;  // what is ready; set by poll()
+};
+
+#define POLLIN   0x01  // read() won't block
+#define POLLOUT  0x04  // write() won't block
+#define POLLHUP  0x10  // the other end of a pipe is closed
+#define POLLNVAL 0x20  // fd is not open
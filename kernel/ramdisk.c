@@ -1,6 +1,9 @@
 //
 // ramdisk that uses the disk image loaded by qemu -initrd fs.img
 //
+// build with make RAMDISK=1 to use it as the root disk
+// instead of the virtio disk.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -11,35 +14,69 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "diskstat.h"
+#include "blkdev.h"
+
+static struct {
+  struct spinlock lock;  // protects stat
+  struct diskstat stat;
+} ramdisk;
 
 void
 ramdiskinit(void)
 {
+  struct superblock *sb = (struct superblock *)(RAMDISK + BSIZE);
+
+  initlock(&ramdisk.lock, "ramdisk");
+  if(sb->magic != FSMAGIC)
+    panic("ramdisk: no file system; run qemu with -initrd fs.img");
+  ramdisk.stat.features = DISK_F_RAMDISK;
+  bdev = &ramdisk_blkdev;
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-ramdiskrw(struct buf *b)
+// copy each buf to or from its block of the image.
+// a memory copy, so there is nothing to wait for.
+static void
+ramdiskrw(struct buf **bufs, int n, int write, int sync)
 {
-  if(!holdingsleep(&b->lock))
-    panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
-
-  if(b->blockno >= FSSIZE)
-    panic("ramdiskrw: blockno too big");
-
-  uint64 diskaddr = b->blockno * BSIZE;
-  char *addr = (char *)RAMDISK + diskaddr;
-
-  if(b->flags & B_DIRTY){
-    // write
-    memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
-  } else {
-    // read
-    memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
+  for(int i = 0; i < n; i++){
+    struct buf *b = bufs[i];
+
+    if(!holdingsleep(&b->lock))
+      panic("ramdiskrw: buf not locked");
+    if(b->blockno >= FSSIZE)
+      panic("ramdiskrw: blockno too big");
+
+    uint64 diskaddr = b->blockno * BSIZE;
+    char *addr = (char *)RAMDISK + diskaddr;
+
+    if(write)
+      memmove(addr, b->data, BSIZE);
+    else
+      memmove(b->data, addr, BSIZE);
   }
+
+  acquire(&ramdisk.lock);
+  ramdisk.stat.nreq++;
+  ramdisk.stat.nblocks += n;
+  if(n > 1)
+    ramdisk.stat.nmerged++;
+  else
+    ramdisk.stat.nsingle++;
+  release(&ramdisk.lock);
+}
+
+static void
+ramdiskstat(struct diskstat *st)
+{
+  acquire(&ramdisk.lock);
+  *st = ramdisk.stat;
+  release(&ramdisk.lock);
 }
+
+struct blkdev ramdisk_blkdev = {
+  .name = "ramdisk",
+  .rw = ramdiskrw,
+  .stat = ramdiskstat,
+  .mode = 0,
+};
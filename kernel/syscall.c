@@ -104,6 +104,22 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_diskstat(void);
+extern uint64 sys_diskmode(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_tee(void);
+extern uint64 sys_vmsplice(void);
+extern uint64 sys_pipestat(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_uringenter(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_syscount(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,14 +143,33 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_diskstat] sys_diskstat,
+[SYS_diskmode] sys_diskmode,
+[SYS_fsync]   sys_fsync,
+[SYS_fcntl]   sys_fcntl,
+[SYS_splice]  sys_splice,
+[SYS_tee]     sys_tee,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_pipestat] sys_pipestat,
+[SYS_sendfile] sys_sendfile,
+[SYS_poll]    sys_poll,
+[SYS_uringenter] sys_uringenter,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_syscount] sys_syscount,
 };
 
+uint64 nsyscall;  // system calls made since boot
+
 void
 syscall(void)
 {
   int num;
   struct proc *p = myproc();
 
+  __sync_fetch_and_add(&nsyscall, 1);
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     p->trapframe->a0 = syscalls[num]();
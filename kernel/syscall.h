@@ -20,3 +20,19 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_diskstat 22
+#define SYS_diskmode 23
+#define SYS_fsync  24
+#define SYS_fcntl  25
+#define SYS_splice 26
+#define SYS_tee    27
+#define SYS_vmsplice 28
+#define SYS_pipestat 29
+#define SYS_sendfile 30
+#define SYS_poll   31
+#define SYS_uringenter 32
+#define SYS_readv  33
+#define SYS_writev 34
+#define SYS_pread  35
+#define SYS_pwrite 36
+#define SYS_syscount 37
@@ -15,6 +15,11 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "diskstat.h"
+#include "pipestat.h"
+#include "uring.h"
+#include "uio.h"
+#include "blkdev.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -91,6 +96,95 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the cnt struct iovecs at user address addr.
+// Their lengths must add up to no more than an int holds,
+// since that is what readv() and writev() return.
+static int
+argiov(uint64 addr, int cnt, struct iovec *iov)
+{
+  int k;
+  uint64 total;
+
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, cnt * sizeof(*iov)) < 0)
+    return -1;
+  total = 0;
+  for(k = 0; k < cnt; k++){
+    if(iov[k].len < 0)
+      return -1;
+    total += iov[k].len;
+  }
+  if(total > 0x7fffffff)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  uint64 p;
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &cnt) < 0)
+    return -1;
+  if(argiov(p, cnt, iov) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  uint64 p;
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &cnt) < 0)
+    return -1;
+  if(argiov(p, cnt, iov) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// Read from a file at an offset, leaving its own offset alone.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int off;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &iov.len) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(iov.len < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int off;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &iov.len) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(iov.len < 0 || off < 0)
+    return -1;
+  iov.base = (void*)p;
+  return filewritev(f, &iov, 1, off);
+}
+
 uint64
 sys_close(void)
 {
@@ -104,6 +198,111 @@ sys_close(void)
   return 0;
 }
 
+// Wait until everything written to the file so far,
+// and every other finished FS update, is on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Control an open file; see fcntl.h.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(cmd == F_GETFL)
+    return f->flags;
+  if(cmd == F_SETFL){
+    f->flags = arg & O_NONBLOCK;
+    return 0;
+  }
+  if(f->type == FD_PIPE)
+    return pipefcntl(f->pipe, cmd, arg);
+  return -1;
+}
+
+// Move up to n bytes from fd in to fd out, one of which
+// must be a pipe, without copying them through user space.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return pipesplice(in, out, n, 0);
+}
+
+// Like splice() between two pipes, but leave the bytes
+// in the first.
+uint64
+sys_tee(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return pipesplice(in, out, n, 1);
+}
+
+// Write n bytes at addr to a pipe, giving it whole pages
+// rather than copying them where it can; the pages given
+// read as zeroes afterwards.
+uint64
+sys_vmsplice(void)
+{
+  struct file *f;
+  uint64 addr;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &addr) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(f->type != FD_PIPE || !f->writable || n < 0)
+    return -1;
+  return pipevmsplice(f->pipe, addr, n);
+}
+
+// Copy up to n bytes from the file open on fd in to fd out,
+// which may be a file, a pipe or a device, without copying
+// them through user space.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filecopy(out, in, n);
+}
+
+// Wait until one of an array of struct pollfds is ready,
+// or for timeout ticks if it isn't negative.
+uint64
+sys_poll(void)
+{
+  uint64 fds; // user pointer to struct pollfd[nfds]
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, nfds, timeout);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -119,7 +318,7 @@ sys_fstat(void)
 uint64
 sys_link(void)
 {
-  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
+  char name[DIRSIZ+1], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
@@ -166,16 +365,18 @@ bad:
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// They are its first two entries.
 static int
 isdirempty(struct inode *dp)
 {
-  int off;
+  uint off;
+  int n;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  for(off = 0, n = 0; off < dp->size; off += de.reclen, n++){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de) || de.reclen == 0)
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(n >= 2 && de.inum != 0)
       return 0;
   }
   return 1;
@@ -185,8 +386,7 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
-  char name[DIRSIZ], path[MAXPATH];
+  char name[DIRSIZ+1], path[MAXPATH];
   uint off;
 
   if(argstr(0, path, MAXPATH) < 0)
@@ -215,9 +415,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -242,7 +440,7 @@ static struct inode*
 create(char *path, short type, short major, short minor)
 {
   struct inode *ip, *dp;
-  char name[DIRSIZ];
+  char name[DIRSIZ+1];
 
   if((dp = nameiparent(path, name)) == 0)
     return 0;
@@ -258,7 +456,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -268,32 +466,39 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+      goto fail;
   }
 
+  // dp's index may be full, or the disk.
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+ fail:
+  // de-allocate ip.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
-uint64
-sys_open(void)
+static int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -340,6 +545,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->flags = omode & O_NONBLOCK;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -351,6 +557,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -484,3 +701,122 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Copy the disk request counters to user space.
+uint64
+sys_diskstat(void)
+{
+  uint64 addr; // user pointer to struct diskstat
+  struct diskstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  bdev->stat(&st);
+  log_stat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Copy the pipe data counters to user space.
+uint64
+sys_pipestat(void)
+{
+  uint64 addr; // user pointer to struct pipestat
+  struct pipestat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  pipestats(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Set the disk completion mode (DISK_MODE_*).
+// Returns the previous mode.
+uint64
+sys_diskmode(void)
+{
+  int mode;
+
+  if(argint(0, &mode) < 0)
+    return -1;
+  if(bdev->mode == 0)
+    return -1;
+  return bdev->mode(mode);
+}
+
+// Do one submission queue entry, with fd from the previous
+// one in *pfd for UR_PREVFD; set *pfd to this entry's fd.
+static int
+uringop(struct sqe *e, int *pfd)
+{
+  struct proc *p = myproc();
+  char path[MAXPATH];
+  struct file *f;
+  int fd;
+
+  if(e->op == UR_NOP)
+    return 0;
+  if(e->op == UR_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return *pfd = -1;
+    return *pfd = fileopen(path, e->len);
+  }
+  fd = *pfd = (e->flags & UR_PREVFD) ? *pfd : e->fd;
+  if(fd < 0 || fd >= NOFILE || (f = p->ofile[fd]) == 0)
+    return -1;
+  switch(e->op){
+  case UR_READ:
+    return fileread(f, e->addr, e->len);
+  case UR_WRITE:
+    return filewrite(f, e->addr, e->len);
+  case UR_CLOSE:
+    p->ofile[fd] = 0;
+    fileclose(f);
+    return 0;
+  case UR_FSTAT:
+    return filestat(f, e->addr);
+  }
+  return -1;
+}
+
+// Do the operations queued in the struct uring at addr, in
+// order, stopping early if its completion queue fills up.
+// Returns how many were done.
+uint64
+sys_uringenter(void)
+{
+  struct proc *p = myproc();
+  uint64 addr; // user pointer to struct uring
+  struct uring *u;
+  uint idx[4]; // sqhead, sqtail, cqhead, cqtail
+  struct sqe e;
+  struct cqe c;
+  int n, fd;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  u = (struct uring*)addr;
+  if(copyin(p->pagetable, (char*)idx, addr, sizeof(idx)) < 0)
+    return -1;
+  if(idx[1] - idx[0] > URING_N || idx[3] - idx[2] > URING_N)
+    return -1;
+
+  fd = -1;
+  for(n = 0; idx[0] != idx[1] && idx[3] - idx[2] < URING_N && !p->killed; n++){
+    if(copyin(p->pagetable, (char*)&e, (uint64)&u->sq[idx[0] % URING_N], sizeof(e)) < 0)
+      return -1;
+    c.data = e.data;
+    c.res = uringop(&e, &fd);
+    c.pad = 0;
+    if(copyout(p->pagetable, (uint64)&u->cq[idx[3] % URING_N], (char*)&c, sizeof(c)) < 0)
+      return -1;
+    idx[0]++;
+    idx[3]++;
+    if(copyout(p->pagetable, addr, (char*)idx, sizeof(idx)) < 0)
+      return -1;
+  }
+  return n;
+}
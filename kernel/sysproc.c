@@ -83,6 +83,13 @@ sys_kill(void)
   return kill(pid);
 }
 
+// How many system calls have been made since boot.
+uint64
+sys_syscount(void)
+{
+  return nsyscall;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
@@ -165,6 +165,7 @@ clockintr()
   acquire(&tickslock);
   ticks++;
   wakeup(&ticks);
+  polltick();
   release(&tickslock);
 }
 
@@ -9,6 +9,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "waitq.h"
 
 // the UART control registers are memory-mapped
 // at address UART0. this macro returns the
@@ -44,6 +45,7 @@ struct spinlock uart_tx_lock;
 char uart_tx_buf[UART_TX_BUF_SIZE];
 int uart_tx_w; // write next to uart_tx_buf[uart_tx_w++]
 int uart_tx_r; // read next from uart_tx_buf[uar_tx_r++]
+struct waitq uart_tx_wq; // poll()s waiting for room in uart_tx_buf
 
 extern volatile int panicked; // from printf.c
 
@@ -108,6 +110,41 @@ uartputc(int c)
   }
 }
 
+// like uartputc(), but return 0 rather than wait
+// if the output buffer is full; 1 if c was queued.
+int
+uarttryputc(int c)
+{
+  int r;
+
+  acquire(&uart_tx_lock);
+  r = 0;
+  if(((uart_tx_w + 1) % UART_TX_BUF_SIZE) != uart_tx_r){
+    uart_tx_buf[uart_tx_w] = c;
+    uart_tx_w = (uart_tx_w + 1) % UART_TX_BUF_SIZE;
+    uartstart();
+    r = 1;
+  }
+  release(&uart_tx_lock);
+  return r;
+}
+
+// is there room in the output buffer? if not, and
+// t isn't 0, add the poll() t to those woken when
+// there is.
+int
+uartpoll(struct polltable *t)
+{
+  int r;
+
+  acquire(&uart_tx_lock);
+  r = ((uart_tx_w + 1) % UART_TX_BUF_SIZE) != uart_tx_r;
+  if(!r)
+    pollwait(&uart_tx_wq, &uart_tx_lock, t);
+  release(&uart_tx_lock);
+  return r;
+}
+
 // alternate version of uartputc() that doesn't 
 // use interrupts, for use by kernel printf() and
 // to echo characters. it spins waiting for the uart's
@@ -153,8 +190,9 @@ uartstart()
     int c = uart_tx_buf[uart_tx_r];
     uart_tx_r = (uart_tx_r + 1) % UART_TX_BUF_SIZE;
     
-    // maybe uartputc() is waiting for space in the buffer.
+    // maybe uartputc() or poll() is waiting for space in the buffer.
     wakeup(&uart_tx_r);
+    pollwake(&uart_tx_wq);
     
     WriteReg(THR, c);
   }
@@ -0,0 +1,8 @@
+// Buffers for readv() and writev().
+
+#define IOV_MAX 16  // most buffers in one call
+
+struct iovec {
+  void *base;
+  int len;
+};
@@ -0,0 +1,48 @@
+// A submission/completion ring, in one page of user memory,
+// for doing many file system calls with one trap. The
+// program fills in sq[] entries and advances sqtail; then
+// uringenter() does the queued operations in order, putting
+// a completion for each in cq[] and advancing sqhead and
+// cqtail. The program consumes completions by advancing
+// cqhead. Indexes run freely; use them mod URING_N.
+
+#define URING_N 64
+
+// operations
+#define UR_NOP    0
+#define UR_READ   1  // read(fd, addr, len)
+#define UR_WRITE  2  // write(fd, addr, len)
+#define UR_OPEN   3  // open(addr, len)
+#define UR_CLOSE  4  // close(fd)
+#define UR_FSTAT  5  // fstat(fd, addr)
+
+// flags
+#define UR_PREVFD 0x1  // use the previous entry's fd, or the fd it
+                       // opened; fail if that open failed
+
+struct sqe {
+  uchar op;
+  uchar flags;
+  ushort pad;
+  int fd;
+  uint64 addr;
+  int len;
+  int pad2;
+  uint64 data;  // copied to the completion
+};
+
+struct cqe {
+  uint64 data;
+  int res;      // what the system call would have returned
+  int pad;
+};
+
+struct uring {
+  uint sqhead;  // advanced by the kernel
+  uint sqtail;  // advanced by the program
+  uint cqhead;  // advanced by the program
+  uint cqtail;  // advanced by the kernel
+  uint pad[4];
+  struct sqe sq[URING_N];
+  struct cqe cq[URING_N];
+};
@@ -43,9 +43,10 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// at most this many virtio descriptors; the driver uses
+// the largest power of two the device also supports.
+// the descriptors and avail ring must fit in one page.
+#define NUM 64
 
 struct VRingDesc {
   uint64 addr;
@@ -53,8 +54,15 @@ struct VRingDesc {
   uint16 flags;
   uint16 next;
 };
-#define VRING_DESC_F_NEXT  1 // chained with another descriptor
-#define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_NEXT     1 // chained with another descriptor
+#define VRING_DESC_F_WRITE    2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr points to a table of descriptors
+
+// avail ring flags: don't interrupt when a request completes.
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+// used ring flags: don't notify when a request is added.
+#define VRING_USED_F_NO_NOTIFY 1
 
 struct VRingUsedElem {
   uint32 id;   // index of start of completed descriptor chain
@@ -65,8 +73,22 @@ struct VRingUsedElem {
 #define VIRTIO_BLK_T_IN  0 // read the disk
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
+// the format of the first descriptor in a disk request.
+// to be followed by descriptors for the data blocks,
+// and then one for a 1-byte status result.
+struct virtio_blk_req {
+  uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
+  uint32 reserved;
+  uint64 sector;
+};
+
+// with VIRTIO_RING_F_EVENT_IDX, the avail ring is followed
+// by used_event (interrupt once the used index passes it),
+// and the used ring by avail_event (notify once the avail
+// index passes it).
 struct UsedArea {
   uint16 flags;
   uint16 id;
   struct VRingUsedElem elems[NUM];
+  uint16 avail_event;
 };
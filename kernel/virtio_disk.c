@@ -16,10 +16,17 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "diskstat.h"
+#include "blkdev.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// how long a polling submitter spins on the used ring
+// before sleeping, in time ticks (about 20us in qemu):
+// about what a fast device takes for a small request.
+#define POLLTIME 200
+
 static struct disk {
  // memory for virtio descriptors &c for queue 0.
  // this is a global instead of allocated because it must
@@ -29,19 +36,43 @@ static struct disk {
   struct VRingDesc *desc;
   uint16 *avail;
   struct UsedArea *used;
+  int num;         // negotiated queue size, <= NUM.
+
+  // with VIRTIO_RING_F_EVENT_IDX, where the driver and the
+  // device tell each other when to next interrupt or notify.
+  volatile uint16 *used_event;
+  volatile uint16 *avail_event;
+  int event_idx;
 
   // our own book-keeping.
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  int nfree;       // how many are.
+  uint16 used_idx; // we've looked this far in used->elems[].
+  uint16 avail_idx; // next avail[] slot; published by kick().
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXIOBLOCKS]; // the run of bufs, in block order
+    int n;
     char status;
   } info[NUM];
-  
+
+  // disk command headers.
+  // one-for-one with descriptors, for convenience.
+  struct virtio_blk_req ops[NUM];
+
+  // descriptor tables for multi-block requests, one per
+  // head descriptor. if the device accepted
+  // VIRTIO_RING_F_INDIRECT_DESC, the head descriptor points
+  // at its table; otherwise the table is copied into a
+  // chain of ring descriptors.
+  struct VRingDesc ind[NUM][MAXIOBLOCKS+2];
+  int indirect;
+
+  struct diskstat stat;
+
   struct spinlock vdisk_lock;
   
 } __attribute__ ((aligned (PGSIZE))) disk;
@@ -73,9 +104,9 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
+  disk.event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -92,22 +123,37 @@ virtio_disk_init(void)
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  if(max < 8)
     panic("virtio disk max queue too short");
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  // ring indices wrap at 2^16, so the size must be a power of two.
+  for(disk.num = NUM; disk.num > max; disk.num /= 2)
+    ;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
   memset(disk.pages, 0, sizeof(disk.pages));
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * VRingDesc
-  // avail = pages + 0x40 -- 2 * uint16, then num * uint16
-  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
+  // avail = pages + num*16 -- 2 * uint16, then num * uint16, then used_event
+  // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem, then avail_event
 
   disk.desc = (struct VRingDesc *) disk.pages;
-  disk.avail = (uint16*)(((char*)disk.desc) + NUM*sizeof(struct VRingDesc));
+  disk.avail = (uint16*)(((char*)disk.desc) + disk.num*sizeof(struct VRingDesc));
   disk.used = (struct UsedArea *) (disk.pages + PGSIZE);
+  disk.used_event = &disk.avail[2 + disk.num];
+  disk.avail_event = (uint16*)&disk.used->elems[disk.num];
 
-  for(int i = 0; i < NUM; i++)
+  for(int i = 0; i < disk.num; i++)
     disk.free[i] = 1;
+  disk.nfree = disk.num;
+
+  disk.stat.qsize = disk.num;
+  if(disk.indirect)
+    disk.stat.features |= DISK_F_INDIRECT;
+  if(disk.event_idx)
+    disk.stat.features |= DISK_F_EVENT_IDX;
+  disk.stat.mode = DISK_MODE_HINT;
+
+  bdev = &virtio_blkdev;
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
@@ -116,9 +162,10 @@ virtio_disk_init(void)
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
+  for(int i = 0; i < disk.num; i++){
     if(disk.free[i]){
       disk.free[i] = 0;
+      disk.nfree--;
       return i;
     }
   }
@@ -129,12 +176,13 @@ alloc_desc()
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("virtio_disk_intr 1");
   if(disk.free[i])
     panic("virtio_disk_intr 2");
   disk.desc[i].addr = 0;
   disk.free[i] = 1;
+  disk.nfree++;
   wakeup(&disk.free[0]);
 }
 
@@ -151,120 +199,381 @@ free_chain(int i)
   }
 }
 
+// how many blocks can one request carry?
 static int
-alloc3_desc(int *idx)
+maxrun(void)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
-  return 0;
+  if(disk.indirect || MAXIOBLOCKS+2 <= disk.num)
+    return MAXIOBLOCKS;
+  return disk.num-2;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// how many descriptors does a request for n blocks take?
+static int
+ndesc(int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec says that legacy block operations use three
-  // descriptors: one for type/reserved/sector, one for
-  // the data, one for a 1-byte status result.
+  return disk.indirect ? 1 : n + 2;
+}
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
+// format a request for the n bufs in b[], which hold
+// consecutive blocks, and queue it in the avail ring.
+// the device won't see it until virtio_disk_kick().
+// returns the head descriptor index, or -1 if there
+// are not ndesc(n) free descriptors.
+// caller holds vdisk_lock.
+static int
+virtio_disk_start(struct buf **b, int n, int write)
+{
+  int head, i, ndesc;
+  int idx[MAXIOBLOCKS+2];
+  struct VRingDesc *d;
+
+  // the spec says that legacy block operations use one
+  // descriptor for type/reserved/sector, one per data
+  // block, and one for a 1-byte status result.
+  ndesc = n + 2;
+  if(disk.indirect){
+    if((head = alloc_desc()) < 0)
+      return -1;
+  } else {
+    for(i = 0; i < ndesc; i++){
+      idx[i] = alloc_desc();
+      if(idx[i] < 0){
+        for(int j = 0; j < i; j++)
+          free_desc(idx[j]);
+        return -1;
+      }
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    head = idx[0];
   }
-  
-  // format the three descriptors.
-  // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  // format the descriptors.
+  // qemu's virtio-blk.c reads them.
+  struct virtio_blk_req *buf0 = &disk.ops[head];
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = b[0]->blockno * (BSIZE / 512);
+
+  d = disk.ind[head];
+  d[0].addr = (uint64) buf0;
+  d[0].len = sizeof(*buf0);
+  d[0].flags = VRING_DESC_F_NEXT;
+  d[0].next = 1;
+
+  for(i = 0; i < n; i++){
+    d[1+i].addr = (uint64) b[i]->data;
+    d[1+i].len = BSIZE;
+    if(write)
+      d[1+i].flags = 0; // device reads b->data
+    else
+      d[1+i].flags = VRING_DESC_F_WRITE; // device writes b->data
+    d[1+i].flags |= VRING_DESC_F_NEXT;
+    d[1+i].next = 2+i;
+
+    // record struct buf for virtio_disk_intr().
+    b[i]->disk = 1;
+    disk.info[head].b[i] = b[i];
+  }
+  disk.info[head].n = n;
+
+  disk.info[head].status = 0xff; // device writes 0 on success
+  d[n+1].addr = (uint64) &disk.info[head].status;
+  d[n+1].len = 1;
+  d[n+1].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[n+1].next = 0;
+
+  if(disk.indirect){
+    disk.desc[head].addr = (uint64) d;
+    disk.desc[head].len = ndesc * sizeof(struct VRingDesc);
+    disk.desc[head].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[head].next = 0;
+  } else {
+    for(i = 0; i < ndesc; i++){
+      disk.desc[idx[i]] = d[i];
+      if(d[i].flags & VRING_DESC_F_NEXT)
+        disk.desc[idx[i]].next = idx[d[i].next];
+    }
+  }
+
+  disk.stat.nreq++;
+  disk.stat.nblocks += n;
+  if(n > 1)
+    disk.stat.nmerged++;
   else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+    disk.stat.nsingle++;
+
+  // avail[2...] are desc[] indices the device should process.
+  // we only tell device the first index in our chain of descriptors.
+  disk.avail[2 + (disk.avail_idx % disk.num)] = head;
+  disk.avail_idx++;
 
-  disk.info[idx[0]].status = 0;
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  return head;
+}
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+// publish the requests queued by virtio_disk_start() and
+// notify the device, unless it has said it will look at
+// the avail ring anyway. one notify covers the whole batch.
+// caller holds vdisk_lock.
+static void
+virtio_disk_kick(void)
+{
+  uint16 old = disk.avail[1];
+  uint16 new = disk.avail_idx;
+
+  if(old == new)
+    return;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
-  // avail[2...] are desc[] indices the device should process.
-  // we only tell device the first index in our chain of descriptors.
-  disk.avail[2 + (disk.avail[1] % NUM)] = idx[0];
   __sync_synchronize();
-  disk.avail[1] = disk.avail[1] + 1;
+  disk.avail[1] = new;
+  __sync_synchronize();
+
+  if(disk.event_idx){
+    // notify only if avail_event lies in [old, new).
+    if((uint16)(new - *disk.avail_event - 1) >= (uint16)(new - old))
+      return;
+  } else if(disk.used->flags & VRING_USED_F_NO_NOTIFY){
+    return;
+  }
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  disk.stat.nnotify++;
+}
+
+// wake up the owners of requests the device has completed.
+// caller holds vdisk_lock.
+static void
+virtio_disk_reap(void)
+{
+  // the device increments used->id as it completes requests;
+  // it may have completed several since we last looked.
+  while(disk.used_idx != *(volatile uint16 *)&disk.used->id){
+    __sync_synchronize();
+    int id = disk.used->elems[disk.used_idx % disk.num].id;
+
+    if(disk.info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    for(int i = 0; i < disk.info[id].n; i++){
+      disk.info[id].b[i]->disk = 0;   // disk is done with buf
+      wakeup(disk.info[id].b[i]);
+    }
+
+    disk.used_idx += 1;
+  }
+}
+
+// ask the device not to interrupt on completions.
+// with EVENT_IDX, a used_event just behind the last
+// reaped request is never crossed.
+static void
+virtio_disk_mute(void)
+{
+  if(disk.event_idx)
+    *disk.used_event = disk.used_idx - 1;
+  else
+    disk.avail[0] = VRING_AVAIL_F_NO_INTERRUPT;
+}
+
+// ask the device to interrupt on the next completion.
+// returns 1 if completions arrived while interrupts were
+// off; the caller must reap them and arm again, since
+// the device won't interrupt for them.
+static int
+virtio_disk_arm(void)
+{
+  if(disk.event_idx)
+    *disk.used_event = disk.used_idx;
+  else
+    disk.avail[0] = 0;
+  __sync_synchronize();
+  return disk.used_idx != *(volatile uint16 *)&disk.used->id;
+}
+
+// record how long a single-block request took.
+static void
+virtio_disk_lat(uint64 t0, int polled, int write)
+{
+  uint64 dt = r_time() - t0;
+  int i;
+
+  for(i = 0; i < DISK_NLAT-1 && dt > 1; i++)
+    dt >>= 1;
+  disk.stat.lat[polled][write][i]++;
+}
+
+// wait until the disk is done with the n bufs in q[].
+// if poll, spin on the used ring for up to POLLTIME first,
+// with interrupts from the device off, before sleeping.
+// returns 1 if polling saw them all complete.
+// caller holds vdisk_lock.
+static int
+virtio_disk_wait(struct buf **q, int n, int poll)
+{
+  uint64 deadline;
+  uint16 seen;
+  int i, polled;
+
+  polled = 0;
+  if(poll){
+    virtio_disk_mute();
+    deadline = r_time() + POLLTIME;
+    for(;;){
+      virtio_disk_reap();
+      for(i = 0; i < n && q[i]->disk == 0; i++)
+        ;
+      if(i == n){
+        polled = 1;
+        break;
+      }
+      if(r_time() >= deadline)
+        break;
+      // spin without the lock, so that other submitters and
+      // the interrupt handler can get on, until the device
+      // completes something.
+      seen = *(volatile uint16 *)&disk.used->id;
+      release(&disk.vdisk_lock);
+      while(*(volatile uint16 *)&disk.used->id == seen && r_time() < deadline)
+        ;
+      acquire(&disk.vdisk_lock);
+    }
+    while(virtio_disk_arm())
+      virtio_disk_reap();
+    if(polled)
+      disk.stat.npolled++;
+  }
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  for(i = 0; i < n; i++){
+    while(q[i]->disk == 1)
+      sleep(q[i], &disk.vdisk_lock);
   }
+  return polled;
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+// read or write the n locked bufs in bufs[], and wait
+// until the disk is done with all of them.
+// the bufs are sorted by block number, elevator style,
+// and each run of adjacent blocks goes to the device as
+// a single multi-block request.
+// sync says the caller is latency sensitive; in
+// DISK_MODE_HINT such requests poll briefly for completion.
+static void
+virtio_disk_rwv(struct buf **bufs, int n, int write, int sync)
+{
+  struct buf *q[MAXIOBLOCKS], *b;
+  int heads[MAXIOBLOCKS], run[MAXIOBLOCKS];
+  int i, j, e, k, s, nrun, need, max, poll, polled;
+  uint64 t0;
+
+  if(n < 1 || n > MAXIOBLOCKS)
+    panic("virtio_disk_rwv");
+
+  // insertion sort by block number, so that one sweep
+  // across the disk services the whole batch.
+  for(i = 0; i < n; i++){
+    b = bufs[i];
+    for(j = i; j > 0 && q[j-1]->blockno > b->blockno; j--)
+      q[j] = q[j-1];
+    q[j] = b;
+  }
+
+  acquire(&disk.vdisk_lock);
+
+  t0 = r_time();
+  max = maxrun();
+  poll = disk.stat.mode == DISK_MODE_POLL ||
+         (disk.stat.mode == DISK_MODE_HINT && sync);
+  polled = 0;
+  for(i = 0; i < n; i = j){
+    // gather the runs from q[i] on whose descriptors fit in
+    // the ring together, usually the whole batch; extend each
+    // run while the next block is adjacent.
+    nrun = need = 0;
+    for(j = i; j < n; j = e){
+      for(e = j+1; e < n && e-j < max; e++)
+        if(q[e]->dev != q[j]->dev || q[e]->blockno != q[e-1]->blockno + 1)
+          break;
+      if(nrun > 0 && need + ndesc(e-j) > disk.num)
+        break;
+      run[nrun++] = e-j;
+      need += ndesc(e-j);
+    }
+
+    // reserve all of their descriptors before queueing any,
+    // so that no one sleeps here holding descriptors that
+    // another batch is waiting for.
+    while(disk.nfree < need)
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    for(k = 0, s = i; k < nrun; s += run[k++])
+      if((heads[k] = virtio_disk_start(q+s, run[k], write)) < 0)
+        panic("virtio_disk_rwv: no descriptors");
+    virtio_disk_kick();
+
+    polled = virtio_disk_wait(q+i, j-i, poll);
+
+    for(k = 0; k < nrun; k++){
+      disk.info[heads[k]].n = 0;
+      free_chain(heads[k]);
+    }
+  }
+
+  if(n == 1)
+    virtio_disk_lat(t0, polled, write);
 
   release(&disk.vdisk_lock);
 }
 
-void
-virtio_disk_intr()
+// copy out the request counters.
+static void
+virtio_disk_stat(struct diskstat *st)
 {
   acquire(&disk.vdisk_lock);
+  *st = disk.stat;
+  release(&disk.vdisk_lock);
+}
 
-  while((disk.used_idx % NUM) != (disk.used->id % NUM)){
-    int id = disk.used->elems[disk.used_idx].id;
+// set the completion mode; returns the old one.
+static int
+virtio_disk_mode(int mode)
+{
+  int old;
 
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-    
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+  if(mode != DISK_MODE_INTR && mode != DISK_MODE_POLL && mode != DISK_MODE_HINT)
+    return -1;
+  acquire(&disk.vdisk_lock);
+  old = disk.stat.mode;
+  disk.stat.mode = mode;
+  release(&disk.vdisk_lock);
+  return old;
+}
 
-    disk.used_idx = (disk.used_idx + 1) % NUM;
-  }
+struct blkdev virtio_blkdev = {
+  .name = "virtio",
+  .rw = virtio_disk_rwv,
+  .stat = virtio_disk_stat,
+  .mode = virtio_disk_mode,
+};
+
+void
+virtio_disk_intr()
+{
+  acquire(&disk.vdisk_lock);
+
+  disk.stat.nintr++;
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
+  // suppress further interrupts while we drain the used ring,
+  // then re-enable them and look again in case a completion
+  // slipped in before that.
+  virtio_disk_mute();
+  virtio_disk_reap();
+  while(virtio_disk_arm())
+    virtio_disk_reap();
+
   release(&disk.vdisk_lock);
 }
@@ -348,6 +348,25 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Make user virtual address va, which must be page-aligned,
+// map physical page pa instead of the page it maps now, with
+// the same permissions. Returns the old page, or 0 if va
+// isn't a writable user page.
+uint64
+uvmremap(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return 0;
+  old = PTE2PA(*pte);
+  *pte = PA2PTE(pa) | PTE_FLAGS(*pte);
+  return old;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -0,0 +1,26 @@
+// poll() waits for many objects at once by putting an entry
+// on each one's wait queue. An object that becomes ready
+// calls pollwake() on its queue, which wakes just the poll()
+// calls waiting for it. Each queue is protected by the lock
+// of the object it belongs to.
+
+struct pollent;
+
+struct waitq {
+  struct pollent *head;
+};
+
+// One poll() call, on its kernel stack.
+struct polltable {
+  struct spinlock lock;
+  int woken;             // an object in ent[] may be ready
+  uint deadline;         // ticks, if timed
+  struct polltable *tnext; // list of timed polls
+  int nent;
+  struct pollent {
+    struct polltable *t;
+    struct waitq *q;
+    struct spinlock *lk; // protects q
+    struct pollent *next;
+  } ent[NOFILE];
+};
@@ -15,14 +15,14 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 2000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = 2*(LOGSIZE+1)+1;  // Log blocks; room for two full transactions. mkfs -l n
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +40,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint dino, char *name, uint inum);
+void dirflush(uint dino);
 
 // convert to intel byte order
 ushort
@@ -68,21 +70,31 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
+    exit(1);
+  }
+
+  if(nlog < 2*MAXOPBLOCKS+2 || nlog > MAXLOG){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n",
+            2*MAXOPBLOCKS+2, MAXLOG);
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
-  assert((BSIZE % sizeof(struct dirent)) == 0);
+  assert(sizeof(struct dirent) == 8);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -118,15 +130,8 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirappend(rootino, ".", rootino);
+  dirappend(rootino, "..", rootino);
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -137,6 +142,7 @@ main(int argc, char *argv[])
       shortname = argv[i];
     
     assert(index(shortname, '/') == 0);
+    assert(strlen(shortname) <= DIRSIZ);
 
     if((fd = open(argv[i], 0)) < 0){
       perror(argv[i]);
@@ -152,10 +158,7 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, shortname, inum);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -163,12 +166,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  dirflush(rootino);
 
   balloc(freeblock);
 
@@ -260,6 +258,49 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding file block fbn of din,
+// allocating it and any indirect blocks on the way.
+uint
+fbmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  unsigned long span;
+  uint x;
+  int level;
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  span = 1;
+  for(level = 0; level < NLEVEL; level++){
+    if(fbn < span * NINDIRECT)
+      break;
+    fbn -= span * NINDIRECT;
+    span *= NINDIRECT;
+  }
+  assert(level < NLEVEL);
+
+  if(xint(din->addrs[NDIRECT+level]) == 0){
+    din->addrs[NDIRECT+level] = xint(freeblock++);
+  }
+  x = xint(din->addrs[NDIRECT+level]);
+  for(; span > 0; span /= NINDIRECT){
+    rsect(x, (char*)indirect);
+    if(indirect[fbn / span] == 0){
+      indirect[fbn / span] = xint(freeblock++);
+      wsect(x, (char*)indirect);
+    }
+    x = xint(indirect[fbn / span]);
+    fbn %= span;
+  }
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -267,7 +308,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -276,22 +316,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -303,3 +328,41 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+char dirbuf[BSIZE];  // directory block being filled
+int dirlen;          // bytes of dirbuf in use
+int dirlast;         // offset of the last dirent in dirbuf
+
+// Add (name, inum) to directory dino, a block at a time.
+void
+dirappend(uint dino, char *name, uint inum)
+{
+  struct dirent *de;
+  int len = strlen(name);
+
+  if(dirlen + DIRENTSZ(len) > BSIZE)
+    dirflush(dino);
+  de = (struct dirent*)(dirbuf + dirlen);
+  de->inum = xint(inum);
+  de->reclen = xshort(DIRENTSZ(len));
+  de->namelen = len;
+  memmove(de->name, name, len);
+  dirlast = dirlen;
+  dirlen += DIRENTSZ(len);
+}
+
+// Write out the directory block being filled; its last
+// dirent takes the space left at the end.
+void
+dirflush(uint dino)
+{
+  struct dirent *de;
+
+  if(dirlen == 0)
+    return;
+  de = (struct dirent*)(dirbuf + dirlast);
+  de->reclen = xshort(BSIZE - dirlast);
+  iappend(dino, dirbuf, BSIZE);
+  bzero(dirbuf, BSIZE);
+  dirlen = 0;
+}
@@ -9,6 +9,28 @@ cat(int fd)
 {
   int n;
 
+  // when fd is a file, or fd or the output is a pipe, let the
+  // kernel move the data; fall back to read() and write() if
+  // it can't.
+  if((n = sendfile(1, fd, 64*1024)) >= 0){
+    while(n > 0)
+      n = sendfile(1, fd, 64*1024);
+    if(n < 0){
+      fprintf(2, "cat: sendfile error\n");
+      exit(1);
+    }
+    return;
+  }
+  if((n = splice(fd, 1, 4096)) >= 0){
+    while(n > 0)
+      n = splice(fd, 1, 4096);
+    if(n < 0){
+      fprintf(2, "cat: splice error\n");
+      exit(1);
+    }
+    return;
+  }
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
@@ -0,0 +1,90 @@
+#include "kernel/types.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/diskstat.h"
+#include "user/user.h"
+
+// Compare interrupt-driven and polled completion latency
+// for single-block disk reads and writes.
+//
+// Each write() below is followed by fsync(), so it commits
+// on its own, with single-block log header writes. Reading a file larger
+// than the buffer cache twice makes every read a disk miss.
+
+#define NWRITE 32
+#define FILEBLOCKS 64
+
+char buf[BSIZE];
+struct diskstat st0, st1;
+uint64 lat[2][2][DISK_NLAT];  // [polled][write][bucket], summed over runs
+
+void
+workload(void)
+{
+  int fd, i, pass;
+
+  fd = open("disklat.tmp", O_CREATE | O_RDWR);
+  if(fd < 0){
+    fprintf(2, "disklat: cannot create disklat.tmp\n");
+    exit(1);
+  }
+  for(i = 0; i < NWRITE; i++){
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "disklat: write failed\n");
+      exit(1);
+    }
+    fsync(fd);
+  }
+  for(; i < FILEBLOCKS; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  for(pass = 0; pass < 2; pass++){
+    fd = open("disklat.tmp", O_RDONLY);
+    while(read(fd, buf, sizeof(buf)) == sizeof(buf))
+      ;
+    close(fd);
+  }
+  unlink("disklat.tmp");
+}
+
+void
+run(int mode)
+{
+  int p, w, i;
+
+  diskmode(mode);
+  diskstat(&st0);
+  workload();
+  diskstat(&st1);
+  for(p = 0; p < 2; p++)
+    for(w = 0; w < 2; w++)
+      for(i = 0; i < DISK_NLAT; i++)
+        lat[p][w][i] += st1.lat[p][w][i] - st0.lat[p][w][i];
+}
+
+int
+main(int argc, char *argv[])
+{
+  int old, i;
+
+  if((old = diskmode(DISK_MODE_INTR)) < 0){
+    fprintf(2, "disklat: diskmode failed\n");
+    exit(1);
+  }
+  run(DISK_MODE_INTR);
+  run(DISK_MODE_POLL);
+  diskmode(old);
+
+  // qemu's time CSR ticks at 10MHz.
+  printf("single-block latency, requests per bucket\n");
+  printf("ticks(>=)\tintr-rd\tintr-wr\tpoll-rd\tpoll-wr\n");
+  for(i = 0; i < DISK_NLAT; i++){
+    if(lat[0][0][i] + lat[0][1][i] + lat[1][0][i] + lat[1][1][i] == 0)
+      continue;
+    printf("%d\t\t%l\t%l\t%l\t%l\n", 1 << i,
+           lat[0][0][i], lat[0][1][i], lat[1][0][i], lat[1][1][i]);
+  }
+  exit(0);
+}
@@ -0,0 +1,167 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "user/user.h"
+
+// An event loop: one process relays what several producers
+// write into their pipes on to a slow consumer, using
+// O_NONBLOCK pipes and poll() rather than a helper process
+// per pipe.
+//
+//   evloop [nprod [nmsg]]
+//       nprod producers (default 3, at most MAXPROD) each
+//       write nmsg lines (default 200).
+
+#define MAXPROD 8
+#define BUFSZ 1024
+
+char buf[BUFSZ];  // read from producers, not yet written
+int len;
+
+void
+producer(int i, int fd, int nmsg)
+{
+  char line[32];
+  int k, n;
+
+  for(k = 0; k < nmsg; k++){
+    strcpy(line, "producer ");
+    n = strlen(line);
+    line[n++] = '0' + i;
+    line[n++] = '\n';
+    if(write(fd, line, n) != n){
+      fprintf(2, "evloop: producer %d: write failed\n", i);
+      exit(1);
+    }
+    // each producer runs at its own rate.
+    if(k % ((i + 1) * 20) == 0)
+      sleep(1);
+  }
+  exit(0);
+}
+
+void
+consumer(int fd)
+{
+  char cbuf[128];
+  int n, total, reads;
+
+  total = reads = 0;
+  while((n = read(fd, cbuf, sizeof(cbuf))) > 0){
+    total += n;
+    // slower than the producers together.
+    if(++reads % 8 == 0)
+      sleep(1);
+  }
+  printf("evloop: consumer read %d bytes\n", total);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct pollfd pfd[MAXPROD+1];
+  int in[MAXPROD], live[MAXPROD], fds[2], sink;
+  int nprod, nmsg, i, n, np, nopen, npoll, nagain, total;
+
+  nprod = argc > 1 ? atoi(argv[1]) : 3;
+  nmsg = argc > 2 ? atoi(argv[2]) : 200;
+  if(nprod < 1 || nprod > MAXPROD){
+    fprintf(2, "usage: evloop [nprod [nmsg]], nprod <= %d\n", MAXPROD);
+    exit(1);
+  }
+
+  for(i = 0; i < nprod; i++){
+    if(pipe(fds) < 0){
+      fprintf(2, "evloop: pipe failed\n");
+      exit(1);
+    }
+    if(fork() == 0){
+      close(fds[0]);
+      producer(i, fds[1], nmsg);
+    }
+    close(fds[1]);
+    in[i] = fds[0];
+    live[i] = 1;
+    fcntl(in[i], F_SETFL, O_NONBLOCK);
+  }
+  if(pipe(fds) < 0){
+    fprintf(2, "evloop: pipe failed\n");
+    exit(1);
+  }
+  if(fork() == 0){
+    close(fds[1]);
+    for(i = 0; i < nprod; i++)
+      close(in[i]);
+    consumer(fds[0]);
+  }
+  close(fds[0]);
+  sink = fds[1];
+  fcntl(sink, F_SETFL, O_NONBLOCK);
+
+  nopen = nprod;
+  npoll = nagain = total = 0;
+  while(nopen > 0 || len > 0){
+    // wait for producers only while there's room to hold what
+    // they send, and for the consumer only with something to
+    // send it.
+    np = 0;
+    if(len < BUFSZ){
+      for(i = 0; i < nprod; i++){
+        if(live[i]){
+          pfd[np].fd = in[i];
+          pfd[np].events = POLLIN;
+          np++;
+        }
+      }
+    }
+    if(len > 0){
+      pfd[np].fd = sink;
+      pfd[np].events = POLLOUT;
+      np++;
+    }
+    if(poll(pfd, np, -1) < 0){
+      fprintf(2, "evloop: poll failed\n");
+      exit(1);
+    }
+    npoll++;
+
+    for(i = 0; i < nprod; i++){
+      // drain each producer until it would block.
+      while(live[i] && len < BUFSZ){
+        n = read(in[i], buf + len, BUFSZ - len);
+        if(n == -EAGAIN){
+          nagain++;
+          break;
+        }
+        if(n <= 0){
+          close(in[i]);
+          live[i] = 0;
+          nopen--;
+          break;
+        }
+        len += n;
+      }
+    }
+    while(len > 0){
+      n = write(sink, buf, len);
+      if(n == -EAGAIN){
+        nagain++;
+        break;
+      }
+      if(n < 0){
+        fprintf(2, "evloop: write to consumer failed\n");
+        exit(1);
+      }
+      memmove(buf, buf + n, len - n);
+      len -= n;
+      total += n;
+    }
+  }
+  close(sink);
+  for(i = 0; i <= nprod; i++)
+    wait(0);
+  printf("evloop: relayed %d bytes with %d polls, %d reads or writes would have blocked\n",
+         total, npoll, nagain);
+  exit(0);
+}
@@ -2,13 +2,50 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/uring.h"
 
+char path[512];  // find() appends each name it looks at
+struct uring ring;
 
+// stat() with one trap rather than three: queue the open,
+// fstat and close on the ring and enter it once.
+int
+rstat(char *n, struct stat *st)
+{
+  struct sqe *e;
+  int i, r;
+
+  e = &ring.sq[ring.sqtail++ % URING_N];
+  e->op = UR_OPEN;
+  e->flags = 0;
+  e->addr = (uint64)n;
+  e->len = O_RDONLY;
+  e = &ring.sq[ring.sqtail++ % URING_N];
+  e->op = UR_FSTAT;
+  e->flags = UR_PREVFD;
+  e->addr = (uint64)st;
+  e = &ring.sq[ring.sqtail++ % URING_N];
+  e->op = UR_CLOSE;
+  e->flags = UR_PREVFD;
+  if(uringenter(&ring) != 3){
+    // drop whatever is left.
+    ring.sqtail = ring.sqhead;
+    ring.cqhead = ring.cqtail;
+    return -1;
+  }
+  r = 0;
+  for(i = 0; i < 3; i++)
+    if(ring.cq[ring.cqhead++ % URING_N].res < 0)
+      r = -1;
+  return r;
+}
 
-void find(char *path, const char *filename)
+// Search the directory named by path, which ends at end.
+void find(char *end, const char *filename)
 {
-  char buf[512], *p;
-  int fd;
+  char skip[128];
+  int fd, n, m;
   struct dirent de;
   struct stat st;
 
@@ -26,33 +63,43 @@ void find(char *path, const char *filename)
   //确保find的第一个参数是目录
   if(st.type != T_DIR){
     fprintf(2, "correct usage: find <DIRECTORY> <filename>\n");
+    close(fd);
     return;
   }
-    
-  if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
+
+  if(end - path + 1 + DIRSIZ + 1 > sizeof path){
       fprintf(2, "find: path too long\n");
+      close(fd);
       return;
   }
 
-  strcpy(buf, path);
-  p = buf+strlen(buf);
-  //p指向最后一个/后的内容
-  *p++ = '/'; 
+  //end指向最后一个/后的内容
+  *end++ = '/';
 
+  // Read each dirent's header and name, then skip the
+  // free space that the rest of its reclen covers.
   while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    n = de.reclen - sizeof(de);
+    if(de.inum != 0){
+      if(read(fd, end, de.namelen) != de.namelen)
+        break;
+      end[de.namelen] = 0;//字符串结束标志
+      n -= de.namelen;
+    }
+    for(; n > 0; n -= m)
+      if((m = read(fd, skip, n < sizeof(skip) ? n : sizeof(skip))) <= 0)
+        break;
     if(de.inum == 0)
-        continue;
-    memmove(p, de.name, DIRSIZ);//添加路径
-    p[DIRSIZ] = 0;//字符串结束标志
-    if(stat(buf, &st) < 0){
-        fprintf(2, "find: cannot stat %s\n", buf);
+      continue;
+    if(rstat(path, &st) < 0){
+        fprintf(2, "find: cannot stat %s\n", path);
         continue;
       }
-      if (st.type == T_DIR && strcmp(p, ".") != 0 && strcmp(p, "..") != 0) {
+      if (st.type == T_DIR && strcmp(end, ".") != 0 && strcmp(end, "..") != 0) {
       //递归查找
-      find(buf, filename);
-    } else if (strcmp(filename, p) == 0)
-      printf("%s\n", buf);
+      find(end + de.namelen, filename);
+    } else if (strcmp(filename, end) == 0)
+      printf("%s\n", path);
   }
 
   close(fd);
@@ -65,6 +112,11 @@ main(int argc, char *argv[])
     fprintf(2, "usage: find <directory> <filename>\n");
     exit(1);
   }
-  find(argv[1], argv[2]);
+  if(strlen(argv[1]) + 1 > sizeof path){
+    fprintf(2, "find: path too long\n");
+    exit(1);
+  }
+  strcpy(path, argv[1]);
+  find(path + strlen(path), argv[2]);
   exit(0);
 }
@@ -0,0 +1,291 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/diskstat.h"
+#include "user/user.h"
+
+// File system benchmarks.
+//
+//   fsbench write [kb]   write kb kilobytes (default 1024) with
+//                        large write() calls, then fsync(); report
+//                        time, log commits and blocks logged.
+//   fsbench seq [kb]     write a kb-kilobyte file (default 4096),
+//                        then read it back sequentially.
+//   fsbench create [n]   create n empty files (default 1000) in a
+//                        new directory, then unlink them, timing
+//                        each hundred.
+//   fsbench copy [kb]    write a kb-kilobyte file (default 4096),
+//                        then copy it with a read()/write() loop
+//                        and with sendfile().
+//   fsbench dir [n]      for directories of 100, 1000, ... up to
+//                        n entries (default 10000), time adding
+//                        the entries, then 1000 lookups of names
+//                        that are there and 1000 of ones that
+//                        aren't.
+
+#define CHUNK (64*1024)
+
+char buf[CHUNK];
+struct diskstat st0, st1;
+
+void
+begin(void)
+{
+  diskstat(&st0);
+}
+
+void
+end(char *what, int t0, uint64 kb)
+{
+  int t = uptime() - t0;
+
+  diskstat(&st1);
+  printf("%s: %d KB in %d ticks", what, (int)kb, t);
+  if(t > 0)
+    printf(" (%d KB/tick)", (int)(kb / t));
+  printf(", %d commits, %d blocks logged, %d installed, %d disk requests\n",
+         st1.ncommit - st0.ncommit, (int)(st1.nlogged - st0.nlogged),
+         (int)(st1.ninstalled - st0.ninstalled), (int)(st1.nreq - st0.nreq));
+}
+
+void
+writefile(char *name, uint64 kb)
+{
+  uint64 total = kb * 1024, done, n;
+  int fd, t0;
+
+  memset(buf, 'w', sizeof(buf));
+  begin();
+  t0 = uptime();
+  if((fd = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "fsbench: cannot create %s\n", name);
+    exit(1);
+  }
+  for(done = 0; done < total; done += n){
+    n = total - done;
+    if(n > CHUNK)
+      n = CHUNK;
+    if(write(fd, buf, n) != n){
+      fprintf(2, "fsbench: write failed\n");
+      exit(1);
+    }
+  }
+  fsync(fd);
+  close(fd);
+  end("write", t0, kb);
+}
+
+void
+readfile(char *name, uint64 kb)
+{
+  uint64 done;
+  int fd, t0, n;
+
+  begin();
+  t0 = uptime();
+  if((fd = open(name, O_RDONLY)) < 0){
+    fprintf(2, "fsbench: cannot open %s\n", name);
+    exit(1);
+  }
+  for(done = 0; (n = read(fd, buf, sizeof(buf))) > 0; done += n)
+    ;
+  close(fd);
+  if(done != kb * 1024){
+    fprintf(2, "fsbench: read %d bytes, not %d\n", (int)done, (int)(kb * 1024));
+    exit(1);
+  }
+  end("read", t0, kb);
+}
+
+void
+copyfile(char *from, char *to, uint64 kb, int usesend)
+{
+  uint64 done;
+  int in, out, t0, n;
+
+  begin();
+  t0 = uptime();
+  if((in = open(from, O_RDONLY)) < 0 || (out = open(to, O_CREATE|O_TRUNC|O_WRONLY)) < 0){
+    fprintf(2, "fsbench: cannot open %s or %s\n", from, to);
+    exit(1);
+  }
+  for(done = 0; ; done += n){
+    if(usesend)
+      n = sendfile(out, in, CHUNK);
+    else if((n = read(in, buf, sizeof(buf))) > 0 && write(out, buf, n) != n)
+      n = -1;
+    if(n <= 0)
+      break;
+  }
+  if(n < 0 || done != kb * 1024){
+    fprintf(2, "fsbench: copied %d bytes, not %d\n", (int)done, (int)(kb * 1024));
+    exit(1);
+  }
+  fsync(out);
+  close(in);
+  close(out);
+  end(usesend ? "sendfile" : "read/write", t0, kb);
+}
+
+void
+filename(char *name, int i)
+{
+  int j;
+
+  name[0] = 'f';
+  for(j = 6; j > 0; j--){
+    name[j] = '0' + i % 10;
+    i /= 10;
+  }
+  name[7] = 0;
+}
+
+void
+createbench(int n)
+{
+  char name[8];
+  int i, fd, t0, t1;
+
+  if(mkdir("fsbench.d") < 0 || chdir("fsbench.d") < 0){
+    fprintf(2, "fsbench: cannot make fsbench.d\n");
+    exit(1);
+  }
+  printf("create: ticks per 100 files:");
+  t0 = t1 = uptime();
+  for(i = 0; i < n; i++){
+    filename(name, i);
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      fprintf(2, "\nfsbench: create %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+    if(i % 100 == 99){
+      printf(" %d", uptime() - t1);
+      t1 = uptime();
+    }
+  }
+  printf("\ncreate: %d files in %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    filename(name, i);
+    unlink(name);
+  }
+  printf("unlink: %d files in %d ticks\n", n, uptime() - t0);
+  chdir("..");
+  unlink("fsbench.d");
+}
+
+// Entries are hard links, so that big directories don't
+// need an inode each; nlink is a short, so every LINKS
+// entries get a new target file.
+#define LINKS 10000
+
+void
+dirbench(int n)
+{
+  char name[8], target[16];
+  struct stat st;
+  int size, i, fd, t0, tadd, thit, tmiss;
+
+  printf("dir: entries, ticks to add them, 1000 hits, 1000 misses\n");
+  for(size = 100; size <= n; size *= 10){
+    if(mkdir("fsbench.d") < 0 || chdir("fsbench.d") < 0){
+      fprintf(2, "fsbench: cannot make fsbench.d\n");
+      exit(1);
+    }
+    t0 = uptime();
+    for(i = 0; i < size; i++){
+      if(i % LINKS == 0){
+        strcpy(target, "../fsbench.t0");
+        target[12] = '0' + i / LINKS;
+        if((fd = open(target, O_CREATE|O_RDWR)) < 0){
+          fprintf(2, "fsbench: cannot create %s\n", target);
+          exit(1);
+        }
+        close(fd);
+      }
+      filename(name, i);
+      if(link(target, name) < 0){
+        fprintf(2, "fsbench: link %s failed\n", name);
+        exit(1);
+      }
+    }
+    tadd = uptime() - t0;
+
+    t0 = uptime();
+    for(i = 0; i < 1000; i++){
+      filename(name, (int)((uint64)i * size / 1000));
+      if(stat(name, &st) < 0){
+        fprintf(2, "fsbench: %s missing\n", name);
+        exit(1);
+      }
+    }
+    thit = uptime() - t0;
+
+    t0 = uptime();
+    for(i = 0; i < 1000; i++){
+      filename(name, size + i);
+      if(stat(name, &st) >= 0){
+        fprintf(2, "fsbench: found %s\n", name);
+        exit(1);
+      }
+    }
+    tmiss = uptime() - t0;
+    printf("dir: %d %d %d %d\n", size, tadd, thit, tmiss);
+
+    for(i = 0; i < size; i++){
+      filename(name, i);
+      unlink(name);
+    }
+    for(i = 0; i < size; i += LINKS){
+      target[12] = '0' + i / LINKS;
+      unlink(target);
+    }
+    chdir("..");
+    if(unlink("fsbench.d") < 0){
+      fprintf(2, "fsbench: cannot remove fsbench.d\n");
+      exit(1);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 2)
+    goto usage;
+  if(strcmp(argv[1], "write") == 0){
+    writefile("fsbench.tmp", argc > 2 ? atoi(argv[2]) : 1024);
+    unlink("fsbench.tmp");
+    exit(0);
+  }
+  if(strcmp(argv[1], "seq") == 0){
+    uint64 kb = argc > 2 ? atoi(argv[2]) : 4096;
+    writefile("fsbench.tmp", kb);
+    readfile("fsbench.tmp", kb);
+    unlink("fsbench.tmp");
+    exit(0);
+  }
+  if(strcmp(argv[1], "copy") == 0){
+    uint64 kb = argc > 2 ? atoi(argv[2]) : 4096;
+    writefile("fsbench.tmp", kb);
+    copyfile("fsbench.tmp", "fsbench.cp", kb, 0);
+    copyfile("fsbench.tmp", "fsbench.cp", kb, 1);
+    unlink("fsbench.tmp");
+    unlink("fsbench.cp");
+    exit(0);
+  }
+  if(strcmp(argv[1], "create") == 0){
+    createbench(argc > 2 ? atoi(argv[2]) : 1000);
+    exit(0);
+  }
+  if(strcmp(argv[1], "dir") == 0){
+    dirbench(argc > 2 ? atoi(argv[2]) : 10000);
+    exit(0);
+  }
+usage:
+  fprintf(2, "usage: fsbench write|seq|copy [kb] | create|dir [n]\n");
+  exit(1);
+}
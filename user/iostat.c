@@ -0,0 +1,72 @@
+#include "kernel/types.h"
+#include "kernel/fs.h"
+#include "kernel/diskstat.h"
+#include "user/user.h"
+
+// Print the disk request and log commit counters, or run a command
+// and print how the counters changed while it ran.
+
+void
+report(struct diskstat *st)
+{
+  printf("requests %l blocks %l single %l merged %l\n",
+         st->nreq, st->nblocks, st->nsingle, st->nmerged);
+  printf("notifies %l interrupts %l", st->nnotify, st->nintr);
+  if(st->nblocks > 0)
+    printf(" (per MB: %l notifies, %l interrupts)",
+           st->nnotify * (1024*1024/BSIZE) / st->nblocks,
+           st->nintr * (1024*1024/BSIZE) / st->nblocks);
+  printf("\n");
+  printf("polled batches %l\n", st->npolled);
+  printf("log commits %d blocks logged %l\n", st->ncommit, st->nlogged);
+  printf("checkpoints %d blocks installed %l\n", st->nckpt, st->ninstalled);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct diskstat st0, st1;
+  int pid;
+
+  if(diskstat(&st0) < 0){
+    fprintf(2, "iostat: diskstat failed\n");
+    exit(1);
+  }
+  if(argc < 2){
+    if(st0.features & DISK_F_RAMDISK)
+      printf("ramdisk\n");
+    else
+      printf("queue size %d%s%s\n", st0.qsize,
+           (st0.features & DISK_F_INDIRECT) ? " indirect" : "",
+           (st0.features & DISK_F_EVENT_IDX) ? " event_idx" : "");
+    report(&st0);
+    exit(0);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "iostat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "iostat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+
+  diskstat(&st1);
+  st1.nreq -= st0.nreq;
+  st1.nblocks -= st0.nblocks;
+  st1.nsingle -= st0.nsingle;
+  st1.nmerged -= st0.nmerged;
+  st1.nnotify -= st0.nnotify;
+  st1.nintr -= st0.nintr;
+  st1.npolled -= st0.npolled;
+  st1.ncommit -= st0.ncommit;
+  st1.nlogged -= st0.nlogged;
+  st1.nckpt -= st0.nckpt;
+  st1.ninstalled -= st0.ninstalled;
+  report(&st1);
+  exit(0);
+}
@@ -3,10 +3,12 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 
+#define NAMEWIDTH 14  // names are padded to this many columns
+
 char*
 fmtname(char *path)
 {
-  static char buf[DIRSIZ+1];
+  static char buf[NAMEWIDTH+1];
   char *p;
 
   // Find first character after last slash.
@@ -15,19 +17,21 @@ fmtname(char *path)
   p++;
 
   // Return blank-padded name.
-  if(strlen(p) >= DIRSIZ)
+  if(strlen(p) >= NAMEWIDTH)
     return p;
   memmove(buf, p, strlen(p));
-  memset(buf+strlen(p), ' ', DIRSIZ-strlen(p));
+  memset(buf+strlen(p), ' ', NAMEWIDTH-strlen(p));
   return buf;
 }
 
+char blk[BSIZE];
+
 void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n, off;
+  struct dirent *de;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -54,16 +58,22 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    // dirents don't cross block boundaries.
+    while((n = read(fd, blk, BSIZE)) > 0){
+      for(off = 0; off < n; off += de->reclen){
+        de = (struct dirent*)(blk + off);
+        if(de->reclen == 0)
+          break;
+        if(de->inum == 0)
+          continue;
+        memmove(p, de->name, de->namelen);
+        p[de->namelen] = 0;
+        if(stat(buf, &st) < 0){
+          printf("ls: cannot stat %s\n", buf);
+          continue;
+        }
+        printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
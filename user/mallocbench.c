@@ -0,0 +1,79 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// malloc() and free() under load: keep NLIVE blocks live,
+// and over and over free a random one and malloc another in
+// its place.
+//
+//   mallocbench [n]
+//       make n thousand replacements (default 200) of small
+//       and of medium blocks, and a twentieth as many of large
+//       ones, and report operations per second, how much the
+//       heap grew, and how much of that it kept once all the
+//       blocks were freed; large blocks should keep none.
+
+#define NLIVE 1000
+#define TICKHZ 10  // timer interrupts per second; see start.c
+
+void *live[NLIVE];
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+void
+run(char *name, uint min, uint max, int n)
+{
+  char *brk0, *brk1;
+  int i, k, t0, t;
+  uint size;
+
+  brk0 = sbrk(0);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    k = rnd() % NLIVE;
+    free(live[k]);
+    size = min + rnd() % (max - min + 1);
+    if((live[k] = malloc(size)) == 0){
+      fprintf(2, "mallocbench: malloc(%d) failed\n", size);
+      exit(1);
+    }
+    // touch it, as a real program would.
+    *(char*)live[k] = 1;
+  }
+  t = uptime() - t0;
+  brk1 = sbrk(0);
+  for(k = 0; k < NLIVE; k++){
+    free(live[k]);
+    live[k] = 0;
+  }
+
+  printf("%s\t%d-%d\t%d\t%d", name, min, max, n * 2, t);
+  if(t > 0)
+    printf("\t%d", (int)((uint64)n * 2 * TICKHZ / t));
+  else
+    printf("\t-");
+  printf("\t%d\t%d\n", (int)(brk1 - brk0) / 1024, (int)((char*)sbrk(0) - brk0) / 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+
+  n = (argc > 1 ? atoi(argv[1]) : 200) * 1000;
+  if(n <= 0){
+    fprintf(2, "usage: mallocbench [n]\n");
+    exit(1);
+  }
+  printf("test\tbytes\tops\tticks\tops/s\tgrewKB\tkeptKB\n");
+  run("small", 1, 128, n);
+  run("medium", 129, 2048, n);
+  // far fewer of these; each one may move the break.
+  run("large", 4096, 32768, n / 20);
+  exit(0);
+}
@@ -0,0 +1,119 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/pipestat.h"
+#include "user/user.h"
+
+// Pipe throughput: a child reads everything a parent writes
+// into a pipe, for write sizes from 1 byte to 64 KB.
+//
+//   pipebench [-v] [mb [kb]]
+//       move up to mb megabytes (default 4) at each write
+//       size; small sizes move less, so that they don't take
+//       all day. With kb, resize the pipe to kb kilobytes and
+//       wake the reader only when it is half full, and the
+//       writer only when it is half empty. With -v, write with
+//       vmsplice() instead of write(), and report how many
+//       bytes went in whole pages rather than copies.
+
+#define MAXWRITE (64*1024)
+#define TICKHZ 10  // timer interrupts per second; see start.c
+
+char rbuf[MAXWRITE];
+char *buf;      // page-aligned, for vmsplice()
+int pipekb;
+int vflag;
+
+void
+run(int size, uint64 total)
+{
+  int fds[2], pid, t0, t;
+  uint64 done;
+  uint64 kbps;
+
+  if(pipe(fds) < 0){
+    fprintf(2, "pipebench: pipe failed\n");
+    exit(1);
+  }
+  if(pipekb > 0){
+    if(fcntl(fds[0], F_SETPIPE_SZ, pipekb * 1024) < 0 ||
+       fcntl(fds[0], F_SETPIPE_HIWAT, pipekb * 512) < 0 ||
+       fcntl(fds[0], F_SETPIPE_LOWAT, pipekb * 512) < 0){
+      fprintf(2, "pipebench: cannot make a %d KB pipe\n", pipekb);
+      exit(1);
+    }
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[1]);
+    done = 0;
+    while((t = read(fds[0], rbuf, sizeof(rbuf))) > 0)
+      done += t;
+    if(done != total){
+      fprintf(2, "pipebench: read %d bytes, not %d\n", (int)done, (int)total);
+      exit(1);
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  for(done = 0; done < total; done += size){
+    if(vflag)
+      t = vmsplice(fds[1], buf, size);
+    else
+      t = write(fds[1], buf, size);
+    if(t != size){
+      fprintf(2, "pipebench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fds[1]);
+  wait(0);
+  t = uptime() - t0;
+
+  printf("%d\t%d\t%d", size, (int)(total / 1024), t);
+  if(t > 0){
+    kbps = total * TICKHZ / 1024 / t;
+    printf("\t%d.%d", (int)(kbps / 1024), (int)(kbps % 1024 * 10 / 1024));
+  }
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 max, total;
+  struct pipestat st0, st1;
+  int size;
+
+  if(argc > 1 && strcmp(argv[1], "-v") == 0){
+    vflag = 1;
+    argc--;
+    argv++;
+  }
+  max = (argc > 1 ? atoi(argv[1]) : 4) * 1024 * 1024;
+  pipekb = argc > 2 ? atoi(argv[2]) : 0;
+  buf = sbrk(MAXWRITE + PGSIZE);
+  buf = (char*)PGROUNDUP((uint64)buf);
+  memset(buf, 'p', MAXWRITE);
+  pipestat(&st0);
+  printf("size\tKB\tticks\tMB/s\n");
+  for(size = 1; size <= MAXWRITE; size *= 4){
+    // about 64K write() calls, or max bytes.
+    total = (uint64)size * 64 * 1024;
+    if(total > max)
+      total = max;
+    total -= total % size;
+    run(size, total);
+  }
+  pipestat(&st1);
+  printf("KB copied %d, spliced %d, given as pages %d\n",
+         (int)((st1.ncopied - st0.ncopied) / 1024),
+         (int)((st1.nspliced - st0.nspliced) / 1024),
+         (int)((st1.ngifted - st0.ngifted) / 1024));
+  exit(0);
+}
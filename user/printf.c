@@ -1,15 +1,117 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
 #include <stdarg.h>
 
 static char digits[] = "0123456789ABCDEF";
 
+#define OBUFSZ 512
+#define IBUFSZ 512
+
+// Output is buffered per fd, and written when the buffer
+// fills, by fflush(), or before fork(), exec(), exit() and
+// close(); see ulib.c. How else depends on what fd is, found
+// on its first use: the console is line buffered, so output
+// appears a line at a time; files and pipes are fully
+// buffered; fd 2 is written at the end of each call.
+enum { OUT_NONE, OUT_FULL, OUT_LINE, OUT_CALL };
+
+static struct {
+  char mode;
+  int n;
+  char buf[OBUFSZ];
+} out[NOFILE];
+
+// Input read ahead by getc() and gets(). Bytes read ahead
+// from a file or pipe are lost to any child that goes on
+// reading the same fd, as sh's children do from fd 0; so fd 0
+// is read a byte at a time unless it is the console, whose
+// reads stop at the end of a line anyway.
+enum { IN_NONE, IN_AHEAD, IN_BYTE };
+
+static struct {
+  char mode;
+  int r, n;
+  char buf[IBUFSZ];
+} in[NOFILE];
+
+extern void (*_stdiohook)(int);
+
+// Write out fd's buffered output, or everyone's if fd is -1.
+void
+fflush(int fd)
+{
+  int i, w;
+
+  if(fd < 0){
+    for(fd = 0; fd < NOFILE; fd++)
+      if(out[fd].n > 0)
+        fflush(fd);
+    return;
+  }
+  if(fd >= NOFILE)
+    return;
+  for(i = 0; i < out[fd].n; i += w)
+    if((w = write(fd, out[fd].buf + i, out[fd].n - i)) <= 0)
+      break;
+  out[fd].n = 0;
+}
+
+static void
+stdiohook(int fd)
+{
+  fflush(fd);
+  if(fd >= 0 && fd < NOFILE){
+    out[fd].mode = OUT_NONE;
+    in[fd].mode = IN_NONE;
+    in[fd].r = in[fd].n = 0;
+  }
+}
+
+static int
+outmode(int fd)
+{
+  struct stat st;
+
+  if(out[fd].mode == OUT_NONE){
+    _stdiohook = stdiohook;
+    if(fd == 2 || fstat(fd, &st) < 0)
+      out[fd].mode = OUT_CALL;
+    else if(st.type == T_DEVICE)
+      out[fd].mode = OUT_LINE;
+    else
+      out[fd].mode = OUT_FULL;
+  }
+  return out[fd].mode;
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  int mode;
+
+  if(fd < 0 || fd >= NOFILE){
+    write(fd, &c, 1);
+    return;
+  }
+  mode = outmode(fd);
+  out[fd].buf[out[fd].n++] = c;
+  if(out[fd].n == OBUFSZ || (c == '\n' && mode == OUT_LINE))
+    fflush(fd);
+}
+
+// Buffered write(): n bytes at p to fd.
+void
+fwrite(int fd, const void *p, int n)
+{
+  const char *s = p;
+
+  while(n-- > 0)
+    putc(fd, *s++);
+  if(fd >= 0 && fd < NOFILE && out[fd].mode == OUT_CALL)
+    fflush(fd);
 }
 
 static void
@@ -48,6 +150,7 @@ printptr(int fd, uint64 x) {
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
+// Output is buffered; see above.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
@@ -92,6 +195,8 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NOFILE && out[fd].mode == OUT_CALL)
+    fflush(fd);
 }
 
 void
@@ -111,3 +216,60 @@ printf(const char *fmt, ...)
   va_start(ap, fmt);
   vprintf(1, fmt, ap);
 }
+
+static int
+inmode(int fd)
+{
+  struct stat st;
+
+  if(in[fd].mode == IN_NONE){
+    _stdiohook = stdiohook;
+    if(fd == 0 && (fstat(fd, &st) < 0 || st.type != T_DEVICE))
+      in[fd].mode = IN_BYTE;
+    else
+      in[fd].mode = IN_AHEAD;
+  }
+  return in[fd].mode;
+}
+
+// The next byte from fd, or -1 at end of file or on error.
+// Reads ahead, except from fd 0 when it isn't the console,
+// so don't mix with read() on the same fd.
+int
+getc(int fd)
+{
+  char c;
+
+  if(fd < 0 || fd >= NOFILE)
+    return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+  if(in[fd].r == in[fd].n){
+    // a prompt without a newline should show before we wait.
+    fflush(-1);
+    if(inmode(fd) == IN_BYTE)
+      return read(fd, &c, 1) == 1 ? (uchar)c : -1;
+    in[fd].r = 0;
+    if((in[fd].n = read(fd, in[fd].buf, IBUFSZ)) <= 0){
+      in[fd].n = 0;
+      return -1;
+    }
+  }
+  return (uchar)in[fd].buf[in[fd].r++];
+}
+
+// Read a line from fd 0 into buf, with at most max-1 bytes,
+// keeping the newline.
+char*
+gets(char *buf, int max)
+{
+  int i, c;
+
+  for(i=0; i+1 < max; ){
+    if((c = getc(0)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return buf;
+}
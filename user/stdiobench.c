@@ -0,0 +1,67 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// Count the system calls a command makes, to see what
+// buffered output saves:
+//
+//   stdiobench [-t] command [arg ...]
+//       run command with its output going to a file (or, with
+//       -t, to the console), and report the system calls made
+//       and ticks taken while it ran, and how much it wrote.
+//       Try it with find and grep.
+
+#define OUTFILE "stdiobench.out"
+
+int
+main(int argc, char *argv[])
+{
+  struct stat st;
+  int tty, pid, fd, n0, t0, n, t;
+
+  tty = argc > 1 && strcmp(argv[1], "-t") == 0;
+  if(argc < 2 + tty){
+    fprintf(2, "usage: stdiobench [-t] command [arg ...]\n");
+    exit(1);
+  }
+  argv += 1 + tty;
+
+  n0 = syscount();
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "stdiobench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(!tty){
+      close(1);
+      if(open(OUTFILE, O_CREATE|O_TRUNC|O_WRONLY) != 1){
+        fprintf(2, "stdiobench: cannot create %s\n", OUTFILE);
+        exit(1);
+      }
+    }
+    exec(argv[0], argv);
+    fprintf(2, "stdiobench: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  wait(0);
+  t = uptime() - t0;
+  // less the fork(), wait() and uptime() calls made here.
+  n = syscount() - n0 - 3;
+
+  st.size = 0;
+  if(!tty){
+    if((fd = open(OUTFILE, O_RDONLY)) >= 0){
+      fstat(fd, &st);
+      close(fd);
+    }
+    unlink(OUTFILE);
+  }
+  fprintf(2, "%s: %d system calls, %d ticks", argv[0], n, t);
+  if(!tty)
+    fprintf(2, ", %d bytes written", (int)st.size);
+  fprintf(2, "\n");
+  exit(0);
+}
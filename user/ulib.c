@@ -3,6 +3,51 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// the system call stubs for the calls wrapped below.
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+
+// Set by printf.c once it buffers anything: flush all
+// buffered output if fd is -1; else flush fd's and forget
+// fd's buffers, because fd is being closed.
+void (*_stdiohook)(int);
+
+// Flush buffered output first, so that a child doesn't
+// write its copy too, and exec() and exit() don't lose it.
+int
+fork(void)
+{
+  if(_stdiohook)
+    _stdiohook(-1);
+  return _fork();
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(_stdiohook)
+    _stdiohook(-1);
+  return _exec(path, argv);
+}
+
+int
+exit(int status)
+{
+  if(_stdiohook)
+    _stdiohook(-1);
+  _exit(status);
+}
+
+int
+close(int fd)
+{
+  if(_stdiohook)
+    _stdiohook(fd);
+  return _close(fd);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -52,24 +97,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
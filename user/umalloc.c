@@ -3,88 +3,214 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Requests of up to MAXSMALL bytes are rounded up to one of
+// NCLASS sizes, each with its own free list, so malloc() and
+// free() just pop and push. A class gets more blocks by
+// carving up a run taken from the large-object allocator;
+// runs are never given back.
+//
+// Larger requests get a span of whole pages of their own,
+// from an address-ordered list of free spans, first fit.
+// Freed spans merge with their neighbours, and a free span
+// of at least TRIM bytes at the top of the heap goes back to
+// the kernel with sbrk(-n).
+//
+// Every block starts with a Header saying which class it is
+// in, or how big its span is. The free lists are threaded
+// through the first word after the header.
 
 typedef long Align;
 
-union header {
+typedef union header {
   struct {
-    union header *ptr;
-    uint size;
+    uint cls;    // size class, or LARGE or RUN
+    uint size;   // LARGE and RUN: bytes in the span, header included
   } s;
   Align x;
-};
+} Header;
 
-typedef union header Header;
+#define NCLASS   16
+#define MAXSMALL 2048
+#define LARGE    NCLASS      // a span holding one large object
+#define RUN      (NCLASS+1)  // a span carved into small blocks
+#define PAGE     4096
+#define MORECORE (16*PAGE)   // least to ask sbrk() for at once
+#define TRIM     (16*PAGE)   // least to give back
 
-static Header base;
-static Header *freep;
+static uint classsize[NCLASS] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+static uchar classof[MAXSMALL/16 + 1];  // by (nbytes+15)/16
+static void *freelist[NCLASS];
+static Header *spans;  // free spans, in address order
 
-void
-free(void *ap)
+#define NEXT(p) (*(void**)(p))  // next free block after p
+
+static void
+initclasses(void)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  int i, c;
+
+  c = 0;
+  for(i = 0; i <= MAXSMALL/16; i++){
+    while(classsize[c] < i * 16)
+      c++;
+    classof[i] = c;
+  }
 }
 
+// Put the span at h, of size bytes, on the free list,
+// merging it with the spans on either side if they are
+// free. Returns the span that now contains it.
 static Header*
-morecore(uint nu)
+spanfree(Header *h, uint size)
 {
-  char *p;
-  Header *hp;
+  Header *p, *prev;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
-    return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  h->s.cls = LARGE;
+  h->s.size = size;
+  prev = 0;
+  for(p = spans; p && p < h; p = NEXT(p + 1))
+    prev = p;
+  if(p && (char*)h + h->s.size == (char*)p){
+    h->s.size += p->s.size;
+    NEXT(h + 1) = NEXT(p + 1);
+  } else {
+    NEXT(h + 1) = p;
+  }
+  if(prev && (char*)prev + prev->s.size == (char*)h){
+    prev->s.size += h->s.size;
+    NEXT(prev + 1) = NEXT(h + 1);
+    return prev;
+  }
+  if(prev)
+    NEXT(prev + 1) = h;
+  else
+    spans = h;
+  return h;
 }
 
-void*
-malloc(uint nbytes)
+// Give h back to the kernel if it is free, big enough, and
+// at the top of the heap.
+static void
+spantrim(Header *h)
 {
-  Header *p, *prevp;
-  uint nunits;
+  Header *p, **pp;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  if(h->s.size < TRIM || (char*)h + h->s.size != sbrk(0))
+    return;
+  for(pp = &spans; (p = *pp) != 0; pp = (Header**)&NEXT(p + 1)){
+    if(p == h){
+      *pp = NEXT(h + 1);
+      sbrk(-(int)h->s.size);
+      return;
+    }
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
+}
+
+// Take a span of size bytes, a multiple of PAGE, from the
+// free list, or from the kernel.
+static Header*
+spanalloc(uint size)
+{
+  Header *p, **pp, *rest;
+  uint grab;
+  char *cp;
+
+  for(;;){
+    for(pp = &spans; (p = *pp) != 0; pp = (Header**)&NEXT(p + 1)){
+      if(p->s.size < size)
+        continue;
+      if(p->s.size - size >= PAGE){
+        rest = (Header*)((char*)p + size);
+        rest->s.cls = LARGE;
+        rest->s.size = p->s.size - size;
+        NEXT(rest + 1) = NEXT(p + 1);
+        *pp = rest;
+      } else {
+        size = p->s.size;
+        *pp = NEXT(p + 1);
       }
-      freep = prevp;
-      return (void*)(p + 1);
+      p->s.size = size;
+      return p;
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
+    grab = size < MORECORE ? MORECORE : size;
+    if((cp = sbrk(grab)) == (char*)-1){
+      if(grab == size || (cp = sbrk(grab = size)) == (char*)-1)
         return 0;
+    }
+    spanfree((Header*)cp, grab);
+  }
+}
+
+// Refill class c's free list from a new run.
+static int
+morecore(int c)
+{
+  Header *run, *h;
+  uint bsize, n;
+  char *p, *end;
+
+  bsize = sizeof(Header) + classsize[c];
+  n = bsize * 16 + sizeof(Header);
+  n = (n + PAGE - 1) / PAGE * PAGE;
+  if((run = spanalloc(n)) == 0)
+    return -1;
+  run->s.cls = RUN;
+  end = (char*)run + run->s.size;
+  for(p = (char*)(run + 1); p + bsize <= end; p += bsize){
+    h = (Header*)p;
+    h->s.cls = c;
+    NEXT(h + 1) = freelist[c];
+    freelist[c] = h + 1;
+  }
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *h;
+  int c;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  c = h->s.cls;
+  if(c < NCLASS){
+    NEXT(ap) = freelist[c];
+    freelist[c] = ap;
+    return;
+  }
+  spantrim(spanfree(h, h->s.size));
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *h;
+  void *p;
+  uint size;
+  int c;
+
+  if(classof[MAXSMALL/16] == 0)
+    initclasses();
+  if(nbytes <= MAXSMALL){
+    c = classof[(nbytes + 15) / 16];
+    if(freelist[c] == 0 && morecore(c) < 0)
+      return 0;
+    p = freelist[c];
+    freelist[c] = NEXT(p);
+    return p;
   }
+  if(nbytes > 0x7fffffff - sizeof(Header) - PAGE)
+    return 0;
+  size = (nbytes + sizeof(Header) + PAGE - 1) / PAGE * PAGE;
+  if((h = spanalloc(size)) == 0)
+    return 0;
+  h->s.cls = LARGE;
+  return (void*)(h + 1);
 }
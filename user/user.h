@@ -1,5 +1,10 @@
 struct stat;
 struct rtcdate;
+struct diskstat;
+struct pipestat;
+struct pollfd;
+struct uring;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -23,6 +28,22 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int diskstat(struct diskstat*);
+int diskmode(int);
+int fsync(int);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int tee(int, int, int);
+int vmsplice(int, const void*, int);
+int pipestat(struct pipestat*);
+int sendfile(int, int, int);
+int poll(struct pollfd*, int, int);
+int uringenter(struct uring*);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int syscount(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -30,9 +51,6 @@ char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void fprintf(int, const char*, ...);
-void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
@@ -40,3 +58,11 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// printf.c
+void fprintf(int, const char*, ...);
+void printf(const char*, ...);
+void fwrite(int, const void*, int);
+void fflush(int);
+int getc(int);
+char* gets(char*, int max);
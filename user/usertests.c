@@ -7,6 +7,11 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/diskstat.h"
+#include "kernel/pipestat.h"
+#include "kernel/poll.h"
+#include "kernel/uring.h"
+#include "kernel/uio.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -523,10 +528,14 @@ writetest(char *s)
   }
 }
 
+// big enough to need a double-indirect block.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + NINDIRECT)
+
 void
 writebig(char *s)
 {
   int i, fd, n;
+  struct stat st;
 
   fd = open("big", O_CREATE|O_RDWR);
   if(fd < 0){
@@ -534,7 +543,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", i);
@@ -554,7 +563,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf("%s: read only %d blocks from big", n);
         exit(1);
       }
@@ -571,6 +580,11 @@ writebig(char *s)
     n++;
   }
   close(fd);
+  // BIGBLOCKS+3 if block-mapped, BIGBLOCKS(+1) if extent-mapped.
+  if(stat("big", &st) < 0 || st.blocks < BIGBLOCKS || st.blocks > BIGBLOCKS + 3){
+    printf("%s: big uses %d blocks\n", s, st.blocks);
+    exit(1);
+  }
   if(unlink("big") < 0){
     printf("%s: unlink big failed\n", s);
     exit(1);
@@ -735,6 +749,634 @@ pipe1(char *s)
   }
 }
 
+// resize a pipe, and move data through it with
+// watermarks that batch wakeups.
+void
+pipesize(char *s)
+{
+  int fds[2], pid, xstatus, i, n, cc, total;
+  enum { SZ=16384, N=20 };
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) < 1){
+    printf("%s: F_GETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, SZ - 1) != SZ ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != SZ){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+
+  // the whole buffer fills without a reader.
+  for(i = 0; i < SZ; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, SZ) != SZ){
+    printf("%s: write to resized pipe failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, SZ/2) >= 0){
+    printf("%s: shrank a pipe below its contents\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 2*SZ) != 2*SZ){
+    printf("%s: grow full pipe failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, SZ);
+  for(total = 0; total < SZ; total += n){
+    if((n = read(fds[0], buf + total, SZ - total)) <= 0){
+      printf("%s: read from resized pipe failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < SZ; i++){
+    if((buf[i] & 0xff) != (i & 0xff)){
+      printf("%s: resized pipe lost data\n", s);
+      exit(1);
+    }
+  }
+
+  if(fcntl(fds[0], F_SETPIPE_HIWAT, 4*SZ) >= 0 ||
+     fcntl(fds[0], F_SETPIPE_HIWAT, SZ) < 0 ||
+     fcntl(fds[1], F_SETPIPE_LOWAT, SZ/2) < 0){
+    printf("%s: setting watermarks failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < N; i++){
+      if(write(fds[1], buf, 1000) != 1000){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  total = 0;
+  while((cc = read(fds[0], buf, 3000)) > 0)
+    total += cc;
+  close(fds[0]);
+  wait(&xstatus);
+  if(total != N * 1000){
+    printf("%s: read %d bytes through watermarks, not %d\n", s, total, N * 1000);
+    exit(1);
+  }
+  exit(xstatus);
+}
+
+// move file data through pipes with splice() and tee(), and
+// give a pipe whole pages with vmsplice().
+void
+splicetest(char *s)
+{
+  int fd, p1[2], p2[2], i, n, total;
+  struct pipestat st0, st1;
+  char *page;
+  enum { SZ=3000 };
+
+  unlink("splice.in");
+  unlink("splice.out");
+  fd = open("splice.in", O_CREATE|O_RDWR);
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create splice.in failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(p1) != 0 || pipe(p2) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(p1[0], F_SETPIPE_SZ, 2*SZ) < 0 || fcntl(p2[0], F_SETPIPE_SZ, 2*SZ) < 0){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  if(splice(p1[0], p1[1], 1) >= 0){
+    printf("%s: spliced a pipe into itself\n", s);
+    exit(1);
+  }
+
+  // file -> p1, tee p1 -> p2, p1 -> file.
+  fd = open("splice.in", O_RDONLY);
+  if(fd < 0 || splice(fd, 1, 1) >= 0){
+    printf("%s: splice without a pipe succeeded\n", s);
+    exit(1);
+  }
+  for(total = 0; total < SZ; total += n){
+    if((n = splice(fd, p1[1], SZ - total)) <= 0){
+      printf("%s: splice file to pipe failed\n", s);
+      exit(1);
+    }
+  }
+  if(splice(fd, p1[1], SZ) != 0){
+    printf("%s: splice past end of file\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(tee(p1[0], p2[1], SZ) != SZ){
+    printf("%s: tee failed\n", s);
+    exit(1);
+  }
+  fd = open("splice.out", O_CREATE|O_RDWR);
+  if(fd < 0 || splice(p1[0], fd, SZ) != SZ){
+    printf("%s: splice pipe to file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  memset(buf, 0, SZ);
+  fd = open("splice.out", O_RDONLY);
+  if(fd < 0 || read(fd, buf, SZ) != SZ){
+    printf("%s: read splice.out failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != 'a' + i % 26){
+      printf("%s: splice.out has wrong data\n", s);
+      exit(1);
+    }
+  }
+  memset(buf, 0, SZ);
+  if(read(p2[0], buf, SZ) != SZ || buf[SZ-1] != 'a' + (SZ-1) % 26){
+    printf("%s: tee'd pipe has wrong data\n", s);
+    exit(1);
+  }
+  unlink("splice.in");
+  unlink("splice.out");
+
+  // vmsplice a page into an empty pipe: the pipe takes it,
+  // and the caller's page reads as zeroes.
+  page = sbrk(2*PGSIZE);
+  page = (char*)PGROUNDUP((uint64)page);
+  memset(page, 'v', PGSIZE);
+  if(pipestat(&st0) < 0 || fcntl(p2[0], F_SETPIPE_SZ, PGSIZE) < 0){
+    printf("%s: pipestat failed\n", s);
+    exit(1);
+  }
+  if(vmsplice(p2[1], page, PGSIZE) != PGSIZE || pipestat(&st1) < 0){
+    printf("%s: vmsplice failed\n", s);
+    exit(1);
+  }
+  if(st1.ngifted - st0.ngifted != PGSIZE || page[0] != 0 || page[PGSIZE-1] != 0){
+    printf("%s: vmsplice copied the page\n", s);
+    exit(1);
+  }
+  for(total = 0; total < PGSIZE; total += n){
+    if((n = read(p2[0], buf, sizeof(buf))) <= 0){
+      printf("%s: read vmspliced page failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < n; i++){
+      if(buf[i] != 'v'){
+        printf("%s: vmspliced page has wrong data\n", s);
+        exit(1);
+      }
+    }
+  }
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+}
+
+// copy files with sendfile(), to a file and to a pipe.
+void
+sendfiletest(char *s)
+{
+  int in, out, fds[2], i, n, total;
+  enum { SZ=5000 };
+
+  unlink("sendfile.in");
+  unlink("sendfile.out");
+  in = open("sendfile.in", O_CREATE|O_RDWR);
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'A' + i % 23;
+  if(in < 0 || write(in, buf, SZ) != SZ){
+    printf("%s: create sendfile.in failed\n", s);
+    exit(1);
+  }
+  close(in);
+
+  in = open("sendfile.in", O_RDONLY);
+  out = open("sendfile.out", O_CREATE|O_RDWR);
+  if(in < 0 || out < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(sendfile(in, in, 1) >= 0 || sendfile(out, open(".", O_RDONLY), 1) >= 0){
+    printf("%s: sendfile from a bad source succeeded\n", s);
+    exit(1);
+  }
+  // a short copy, then the rest, then nothing at the end.
+  if(sendfile(out, in, 100) != 100 || sendfile(out, in, SZ) != SZ - 100 ||
+     sendfile(out, in, SZ) != 0){
+    printf("%s: sendfile to a file failed\n", s);
+    exit(1);
+  }
+  close(out);
+  memset(buf, 0, SZ);
+  out = open("sendfile.out", O_RDONLY);
+  if(out < 0 || read(out, buf, SZ + 1) != SZ){
+    printf("%s: sendfile.out has the wrong size\n", s);
+    exit(1);
+  }
+  close(out);
+  for(i = 0; i < SZ; i++){
+    if(buf[i] != 'A' + i % 23){
+      printf("%s: sendfile.out has wrong data\n", s);
+      exit(1);
+    }
+  }
+
+  // to a pipe, from the start of the file again.
+  close(in);
+  in = open("sendfile.in", O_RDONLY);
+  if(pipe(fds) != 0 || fcntl(fds[1], F_SETPIPE_SZ, 2*SZ) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  for(total = 0; total < SZ; total += n){
+    if((n = sendfile(fds[1], in, SZ - total)) <= 0){
+      printf("%s: sendfile to a pipe failed\n", s);
+      exit(1);
+    }
+  }
+  close(fds[1]);
+  memset(buf, 0, SZ);
+  for(total = 0; (n = read(fds[0], buf + total, SZ - total)) > 0; total += n)
+    ;
+  if(total != SZ || buf[SZ-1] != 'A' + (SZ-1) % 23){
+    printf("%s: pipe from sendfile has wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(in);
+  unlink("sendfile.in");
+  unlink("sendfile.out");
+}
+
+// wait on several pipes at once with poll().
+void
+polltest(char *s)
+{
+  int fds[3][2], i, pid, xstatus;
+  struct pollfd pfd[4];
+  char c;
+
+  for(i = 0; i < 3; i++){
+    if(pipe(fds[i]) != 0){
+      printf("%s: pipe() failed\n", s);
+      exit(1);
+    }
+    pfd[i].fd = fds[i][0];
+    pfd[i].events = POLLIN;
+  }
+  pfd[3].fd = fds[0][1];
+  pfd[3].events = POLLIN|POLLOUT;
+  if(poll(pfd, 4, 0) != 1 || pfd[0].revents || pfd[3].revents != POLLOUT){
+    printf("%s: poll of empty pipes\n", s);
+    exit(1);
+  }
+  if(poll(pfd, 3, 2) != 0){
+    printf("%s: poll didn't time out\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(1);
+    write(fds[1][1], "x", 1);
+    exit(0);
+  }
+  if(poll(pfd, 3, -1) != 1 || pfd[0].revents || pfd[1].revents != POLLIN ||
+     pfd[2].revents){
+    printf("%s: poll missed a write\n", s);
+    exit(1);
+  }
+  if(read(fds[1][0], &c, 1) != 1 || c != 'x'){
+    printf("%s: read after poll failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+
+  close(fds[2][1]);
+  pfd[0].fd = 99;
+  if(poll(pfd, 3, -1) != 2 || pfd[0].revents != POLLNVAL ||
+     pfd[2].revents != (POLLIN|POLLHUP)){
+    printf("%s: poll of closed pipe\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    close(fds[i][0]);
+    if(i != 2)
+      close(fds[i][1]);
+  }
+}
+
+// O_NONBLOCK pipe ends return -EAGAIN instead of waiting.
+void
+nonblock(char *s)
+{
+  int fds[2], n, sz, total;
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETFL, 0) != 0 ||
+     fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[0], F_GETFL, 0) != O_NONBLOCK){
+    printf("%s: F_SETFL failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], &c, 1) != -EAGAIN){
+    printf("%s: read of empty pipe didn't return -EAGAIN\n", s);
+    exit(1);
+  }
+
+  // fill the pipe: a short write, then -EAGAIN.
+  sz = fcntl(fds[0], F_GETPIPE_SZ, 0);
+  if(sz <= 0 || sz >= BUFSZ){
+    printf("%s: F_GETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'n', BUFSZ);
+  if(write(fds[1], buf, sz + 100) != sz || write(fds[1], buf, 1) != -EAGAIN){
+    printf("%s: write to full pipe\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  for(total = 0; (n = read(fds[0], buf, BUFSZ)) > 0; total += n)
+    ;
+  if(n != 0 || total != sz){
+    printf("%s: read %d bytes, then %d\n", s, total, n);
+    exit(1);
+  }
+  close(fds[0]);
+}
+
+struct uring ring;
+
+static struct sqe*
+ringsqe(int op, int flags, int fd, void *addr, int len)
+{
+  struct sqe *e = &ring.sq[ring.sqtail++ % URING_N];
+
+  e->op = op;
+  e->flags = flags;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->len = len;
+  e->data = ring.sqtail;
+  return e;
+}
+
+// batch system calls through a submission ring.
+void
+uringtest(char *s)
+{
+  struct stat st;
+  struct cqe *c;
+  char rbuf[8];
+  int i, n;
+
+  unlink("uring.tmp");
+  ringsqe(UR_OPEN, 0, 0, "uring.tmp", O_CREATE|O_RDWR);
+  ringsqe(UR_WRITE, UR_PREVFD, 0, "hello", 5);
+  ringsqe(UR_FSTAT, UR_PREVFD, 0, &st, 0);
+  ringsqe(UR_CLOSE, UR_PREVFD, 0, 0, 0);
+  ringsqe(UR_OPEN, 0, 0, "uring.tmp", O_RDONLY);
+  ringsqe(UR_READ, UR_PREVFD, 0, rbuf, sizeof(rbuf));
+  ringsqe(UR_CLOSE, UR_PREVFD, 0, 0, 0);
+  ringsqe(UR_OPEN, 0, 0, "uring.nonexistent", O_RDONLY);
+  ringsqe(UR_CLOSE, UR_PREVFD, 0, 0, 0);
+  ringsqe(UR_NOP, 0, 0, 0, 0);
+  if((n = uringenter(&ring)) != 10 || ring.sqhead != ring.sqtail ||
+     ring.cqtail - ring.cqhead != 10){
+    printf("%s: uringenter did %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < 10; i++){
+    c = &ring.cq[ring.cqhead++ % URING_N];
+    if(c->data != i + 1){
+      printf("%s: completion %d out of order\n", s, i);
+      exit(1);
+    }
+    if((i == 0 || i == 4) ? c->res < 0 :
+       (i == 1 || i == 5) ? c->res != 5 :
+       (i == 7 || i == 8) ? c->res != -1 : c->res != 0){
+      printf("%s: completion %d has result %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  if(st.size != 5 || memcmp(rbuf, "hello", 5) != 0){
+    printf("%s: ring I/O has wrong data\n", s);
+    exit(1);
+  }
+
+  // a full completion queue stops the batch.
+  for(i = 0; i < URING_N; i++)
+    ringsqe(UR_NOP, 0, 0, 0, 0);
+  ring.cqhead -= 2;
+  if(uringenter(&ring) != URING_N - 2 || uringenter(&ring) != 0){
+    printf("%s: ring overran its completion queue\n", s);
+    exit(1);
+  }
+  ring.cqhead = ring.cqtail;
+  if(uringenter(&ring) != 2){
+    printf("%s: ring lost entries\n", s);
+    exit(1);
+  }
+  unlink("uring.tmp");
+}
+
+// gather and scatter with writev() and readv(), and read and
+// write at offsets with pread() and pwrite().
+void
+vectorio(char *s)
+{
+  struct iovec iov[3];
+  char a[4], b[8];
+  int fd, fds[2];
+
+  unlink("vectorio");
+  fd = open("vectorio", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  iov[0].base = "abc";
+  iov[0].len = 3;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "defgh";
+  iov[2].len = 5;
+  if(writev(fd, iov, 3) != 8 || write(fd, "i", 1) != 1){
+    printf("%s: writev to file failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 3) != 2 || pread(fd, b, 4, 2) != 4 ||
+     memcmp(b, "cXYf", 4) != 0){
+    printf("%s: pwrite/pread failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 8, 9) != 0 || pwrite(fd, "z", 1, 100) >= 0){
+    printf("%s: pread/pwrite past the end\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("vectorio", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  if(readv(fd, iov, 2) != 9 || memcmp(a, "abcX", 4) != 0 ||
+     memcmp(b, "Yfghi", 5) != 0 || read(fd, b, 1) != 0){
+    printf("%s: readv from file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("vectorio");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  iov[0].base = "pipe";
+  iov[0].len = 4;
+  iov[1].base = "line";
+  iov[1].len = 4;
+  if(writev(fds[1], iov, 2) != 8 || pread(fds[0], b, 1, 0) >= 0){
+    printf("%s: writev to pipe failed\n", s);
+    exit(1);
+  }
+  iov[0].base = a;
+  iov[0].len = 2;
+  iov[1].base = b;
+  iov[1].len = 8;
+  if(readv(fds[0], iov, 2) != 8 || memcmp(a, "pi", 2) != 0 ||
+     memcmp(b, "peline", 6) != 0){
+    printf("%s: readv from pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// buffered output to a file, with fork() and close() flushing
+// it, and buffered input with getc().
+void
+stdiotest(char *s)
+{
+  int fd, pid, xstatus, n0, i, c;
+  char rbuf[64];
+
+  unlink("stdio.tmp");
+  fd = open("stdio.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  n0 = syscount();
+  for(i = 0; i < 10; i++)
+    fprintf(fd, "%d", i);
+  if(syscount() - n0 > 2){
+    printf("%s: fprintf to a file wasn't buffered\n", s);
+    exit(1);
+  }
+  // the child must not write a second copy.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    fprintf(fd, "c");
+    exit(0);
+  }
+  wait(&xstatus);
+  fprintf(fd, "p\n");
+  close(fd);
+
+  fd = open("stdio.tmp", O_RDONLY);
+  for(i = 0; (c = getc(fd)) >= 0 && i < sizeof(rbuf) - 1; i++)
+    rbuf[i] = c;
+  rbuf[i] = 0;
+  close(fd);
+  if(strcmp(rbuf, "0123456789cp\n") != 0){
+    printf("%s: file has %s\n", s, rbuf);
+    exit(1);
+  }
+  unlink("stdio.tmp");
+}
+
+// blocks of every size class and some large ones keep their
+// contents, freed blocks get reused, and freeing a large block
+// at the top of the heap gives the memory back.
+void
+malloctest(char *s)
+{
+  char *p[64], *q, *brk;
+  int i, j, n;
+
+  for(i = 0; i < 64; i++){
+    n = i < 48 ? i * 45 : (i - 47) * 5000;
+    if((p[i] = malloc(n + 1)) == 0){
+      printf("%s: malloc(%d) failed\n", s, n + 1);
+      exit(1);
+    }
+    memset(p[i], i, n + 1);
+  }
+  for(i = 0; i < 64; i++){
+    n = i < 48 ? i * 45 : (i - 47) * 5000;
+    for(j = 0; j <= n; j++){
+      if(p[i][j] != i){
+        printf("%s: block %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  q = p[10];
+  free(p[10]);
+  if((p[10] = malloc(10 * 45 + 1)) != q){
+    printf("%s: freed block not reused\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 64; i++)
+    free(p[i]);
+
+  if((q = malloc(256*1024)) == 0){
+    printf("%s: malloc(256K) failed\n", s);
+    exit(1);
+  }
+  q[256*1024 - 1] = 1;
+  brk = sbrk(0);
+  free(q);
+  if(sbrk(0) >= brk){
+    printf("%s: free() kept 256K at the top of the heap\n", s);
+    exit(1);
+  }
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -1314,12 +1956,9 @@ concreate(char *s)
 {
   enum { N = 40 };
   char file[3];
-  int i, pid, n, fd;
+  int i, pid, n, fd, cc, off;
   char fa[N];
-  struct {
-    ushort inum;
-    char name[DIRSIZ];
-  } de;
+  struct dirent *de;
 
   file[0] = 'C';
   file[2] = '\0';
@@ -1352,21 +1991,28 @@ concreate(char *s)
   memset(fa, 0, sizeof(fa));
   fd = open(".", 0);
   n = 0;
-  while(read(fd, &de, sizeof(de)) > 0){
-    if(de.inum == 0)
-      continue;
-    if(de.name[0] == 'C' && de.name[2] == '\0'){
-      i = de.name[1] - '0';
-      if(i < 0 || i >= sizeof(fa)){
-        printf("%s: concreate weird file %s\n", s, de.name);
+  while((cc = read(fd, buf, BSIZE)) > 0){
+    for(off = 0; off < cc; off += de->reclen){
+      de = (struct dirent*)(buf + off);
+      if(de->reclen == 0){
+        printf("%s: concreate bad dirent\n", s);
         exit(1);
       }
-      if(fa[i]){
-        printf("%s: concreate duplicate file %s\n", s, de.name);
-        exit(1);
+      if(de->inum == 0)
+        continue;
+      if(de->namelen == 2 && de->name[0] == 'C'){
+        i = de->name[1] - '0';
+        if(i < 0 || i >= sizeof(fa)){
+          printf("%s: concreate weird file C%c\n", s, de->name[1]);
+          exit(1);
+        }
+        if(fa[i]){
+          printf("%s: concreate duplicate file C%c\n", s, de->name[1]);
+          exit(1);
+        }
+        fa[i] = 1;
+        n++;
       }
-      fa[i] = 1;
-      n++;
     }
   }
   close(fd);
@@ -1737,50 +2383,434 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// fsync() waits for the log to commit; it only
+// applies to files.
 void
-fourteen(char *s)
+fsynctest(char *s)
 {
-  int fd;
+  int fd, fds[2];
+
+  unlink("fsync");
+  fd = open("fsync", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create fsync\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 4; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
 
-  // DIRSIZ is 14.
+  fd = open("fsync", O_RDONLY);
+  for(int i = 0; i < 4; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a' + i || buf[BSIZE-1] != 'a' + i){
+      printf("%s: read back wrong data\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("fsync");
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a multi-block write commits a run of adjacent log
+// blocks, which the disk driver should send as one request.
+void
+diskmerge(char *s)
+{
+  struct diskstat st0, st1;
+  int fd;
+
+  unlink("diskmerge");
+  if(diskstat(&st0) < 0){
+    printf("%s: diskstat failed\n", s);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  fd = open("diskmerge", O_CREATE | O_RDWR);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: cannot create diskmerge\n", s);
     exit(1);
   }
+  memset(buf, 'm', 3*BSIZE);
+  if(write(fd, buf, 3*BSIZE) != 3*BSIZE){
+    printf("%s: write diskmerge failed\n", s);
+    exit(1);
+  }
+  fsync(fd);
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  unlink("diskmerge");
+  diskstat(&st1);
+  if(st1.nmerged <= st0.nmerged){
+    printf("%s: no merged disk requests\n", s);
+    exit(1);
+  }
+  if(st1.nblocks - st0.nblocks <= st1.nreq - st0.nreq){
+    printf("%s: requests did not carry multiple blocks\n", s);
+    exit(1);
+  }
+}
+
+// a large write() should take a few big transactions,
+// not one per handful of blocks.
+void
+bigtrans(char *s)
+{
+  struct diskstat st0, st1;
+  int fd, n;
+  char *p;
+
+  n = 200*BSIZE;
+  p = sbrk(n);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  memset(p, 't', n);
+  unlink("bigtrans");
+  fd = open("bigtrans", O_CREATE | O_RDWR);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: cannot create bigtrans\n", s);
+    exit(1);
+  }
+  fsync(fd);
+  diskstat(&st0);
+  if(write(fd, p, n) != n){
+    printf("%s: write bigtrans failed\n", s);
     exit(1);
   }
+  fsync(fd);
+  diskstat(&st1);
   close(fd);
+  unlink("bigtrans");
+  if(st1.ncommit - st0.ncommit > 6){
+    printf("%s: %d commits for one write\n", s, st1.ncommit - st0.ncommit);
+    exit(1);
+  }
+}
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+// a file written sequentially should be a few extents,
+// read back with multi-block disk requests.
+void
+extentfile(char *s)
+{
+  struct diskstat st0, st1;
+  struct stat st;
+  int fd, i, n;
+  char *p;
+
+  n = 64*BSIZE;
+  p = sbrk(n);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  unlink("extentfile");
+  fd = open("extentfile", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: cannot create extentfile\n", s);
+    exit(1);
+  }
+  // larger than the buffer cache, so reads miss.
+  for(i = 0; i < 1024*BSIZE/n; i++){
+    memset(p, i, n);
+    if(write(fd, p, n) != n){
+      printf("%s: write extentfile failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(stat("extentfile", &st) < 0 || st.blocks < 1024 || st.blocks > 1025){
+    printf("%s: extentfile uses %d blocks\n", s, st.blocks);
     exit(1);
   }
 
-  // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
+  fd = open("extentfile", O_RDONLY);
+  diskstat(&st0);
+  for(i = 0; i < 1024*BSIZE/n; i++){
+    if(read(fd, p, n) != n || p[0] != (char)i || p[n-1] != (char)i){
+      printf("%s: read extentfile failed\n", s);
+      exit(1);
+    }
+  }
+  diskstat(&st1);
+  close(fd);
+  unlink("extentfile");
+  if(st1.nmerged <= st0.nmerged){
+    printf("%s: no merged reads\n", s);
+    exit(1);
+  }
+}
+
+// hold more inodes open at once than the inode cache
+// keeps, so that it must grow, and then shrink again.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 5, NF = 12 };
+  char name[4];
+  int c, i, pid, xstatus, fds[2];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(c = 0; c < NCHILD; c++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      name[0] = 'i';
+      name[1] = 'a' + c;
+      name[3] = 0;
+      for(i = 0; i < NF; i++){
+        name[2] = 'a' + i;
+        if(open(name, O_CREATE | O_RDWR) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      // wait until every child holds its files open.
+      read(fds[0], name, 1);
+      for(i = 0; i < NF; i++){
+        name[2] = 'a' + i;
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  sleep(10);
+  close(fds[1]);
+  for(c = 0; c < NCHILD; c++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+// the name of file i in diskfull()'s directory, long so that
+// few fit in a block.
+void
+dfname(char *p, int i)
+{
+  strcpy(p, "dfdir/a-rather-long-file-name-000");
+  p[30] = '0' + i / 100;
+  p[31] = '0' + i / 10 % 10;
+  p[32] = '0' + i % 10;
+}
+
+// on a full disk, creating a file in an indexed directory
+// that must grow to hold the name should fail, not panic,
+// and leave the directory as it was.
+void
+diskfull(char *s)
+{
+  enum { NOLD = 100, NNEW = 400 };
+  char name[40], big[8];
+  int i, j, fd, nbig, n;
+
+  if(mkdir("dfdir") < 0){
+    printf("%s: mkdir dfdir failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NOLD; i++){
+    dfname(name, i);
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  // fill the disk, a file at a time until one gets nothing.
+  strcpy(big, "dfbig0");
+  for(nbig = 0; nbig < 10; nbig++){
+    big[5] = '0' + nbig;
+    if((fd = open(big, O_CREATE | O_RDWR)) < 0)
+      break;
+    j = 0;
+    while((n = write(fd, buf, BUFSZ)) > 0)
+      j += n;
+    close(fd);
+    if(j == 0)
+      break;
+  }
+
+  for(i = NOLD; i < NOLD + NNEW; i++){
+    dfname(name, i);
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0)
+      break;
+    close(fd);
+  }
+  if(i == NOLD + NNEW){
+    printf("%s: the directory never filled up\n", s);
+    exit(1);
+  }
+  if(open(name, O_RDONLY) >= 0){
+    printf("%s: %s exists after a failed create\n", s, name);
+    exit(1);
+  }
+  for(j = 0; j < i; j++){
+    dfname(name, j);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: %s missing on a full disk\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  for(j = 0; j <= nbig && j < 10; j++){
+    big[5] = '0' + j;
+    unlink(big);
+  }
+  dfname(name, i);
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+    printf("%s: create %s failed after freeing space\n", s, name);
+    exit(1);
+  }
+  close(fd);
+  for(j = 0; j <= i; j++){
+    dfname(name, j);
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("dfdir") < 0){
+    printf("%s: unlink dfdir failed\n", s);
+    exit(1);
+  }
+}
+
+// path lookups must see creates, links, and unlinks,
+// even of names looked up (and not found) before.
+void
+dcachetest(char *s)
+{
+  struct stat st;
+  int fd, i;
+
+  unlink("dc/a");
+  unlink("dc/b");
+  unlink("dc");
+  for(i = 0; i < 2; i++){
+    if(mkdir("dc") < 0){
+      printf("%s: mkdir dc failed\n", s);
+      exit(1);
+    }
+    if(open("dc/a", O_RDONLY) >= 0){
+      printf("%s: opened dc/a before creating it\n", s);
+      exit(1);
+    }
+    fd = open("dc/a", O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: create dc/a failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(open("dc/b", O_RDONLY) >= 0 || link("dc/a", "dc/b") < 0 ||
+       stat("dc/b", &st) < 0){
+      printf("%s: link dc/b failed\n", s);
+      exit(1);
+    }
+    if(unlink("dc/a") < 0 || open("dc/a", O_RDONLY) >= 0){
+      printf("%s: dc/a still there after unlink\n", s);
+      exit(1);
+    }
+    if(unlink("dc/b") < 0 || stat("dc/b", &st) >= 0){
+      printf("%s: dc/b still there after unlink\n", s);
+      exit(1);
+    }
+    // the next mkdir may reuse dc's inode.
+    if(unlink("dc") < 0 || chdir("dc") >= 0){
+      printf("%s: dc still there after unlink\n", s);
+      exit(1);
+    }
+  }
+}
+
+// names are kept up to DIRSIZ (255) bytes, and truncated
+// beyond that.
+void
+longname(char *s)
+{
+  static char a[DIRSIZ+2], b[2*DIRSIZ+2];
+  int fd;
+
+  memset(a, 'a', DIRSIZ+1);
+  a[DIRSIZ+1] = 0;
+  fd = open(a, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create %d-byte name failed\n", s, DIRSIZ+1);
+    exit(1);
+  }
+  close(fd);
+  a[DIRSIZ] = 0;
+  if((fd = open(a, O_RDONLY)) < 0){
+    printf("%s: open %d-byte name failed\n", s, DIRSIZ);
+    exit(1);
+  }
+  close(fd);
+  a[DIRSIZ-1] = 0;
+  if(open(a, O_RDONLY) >= 0){
+    printf("%s: opened a %d-byte prefix\n", s, DIRSIZ-1);
+    exit(1);
+  }
+
+  // a directory and a file in it, both with long names.
+  memset(b, 'b', 2*DIRSIZ+1);
+  b[DIRSIZ] = 0;
+  if(mkdir(b) < 0){
+    printf("%s: mkdir %d-byte name failed\n", s, DIRSIZ);
+    exit(1);
+  }
+  b[DIRSIZ] = '/';
+  b[2*DIRSIZ+1] = 0;
+  fd = open(b, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create %s failed\n", s, b);
+    exit(1);
+  }
+  if(write(fd, "x", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink(b) < 0){
+    printf("%s: unlink %s failed\n", s, b);
+    exit(1);
+  }
+  b[DIRSIZ] = 0;
+  if(unlink(b) < 0){
+    printf("%s: unlink %d-byte directory failed\n", s, DIRSIZ);
+    exit(1);
+  }
+  a[DIRSIZ-1] = 'a';
+  if(unlink(a) < 0){
+    printf("%s: unlink %d-byte name failed\n", s, DIRSIZ);
+    exit(1);
+  }
 }
 
 void
@@ -2685,14 +3715,30 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipesize, "pipesize"},
+    {splicetest, "splice"},
+    {sendfiletest, "sendfile"},
+    {polltest, "poll"},
+    {nonblock, "nonblock"},
+    {uringtest, "uring"},
+    {vectorio, "vectorio"},
+    {stdiotest, "stdio"},
+    {malloctest, "malloc"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
-    {fourteen, "fourteen"},
+    {longname, "longname"},
     {bigfile, "bigfile"},
+    {diskmerge, "diskmerge"},
+    {bigtrans, "bigtrans"},
+    {extentfile, "extentfile"},
+    {manyinodes, "manyinodes"},
+    {dcachetest, "dcache"},
+    {fsynctest, "fsync"},
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {diskfull, "diskfull"}, // slow
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
@@ -6,24 +6,27 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("name", "label") names the stub label, for system
+# calls that ulib.c wraps.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -36,3 +39,19 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("diskstat");
+entry("diskmode");
+entry("fsync");
+entry("fcntl");
+entry("splice");
+entry("tee");
+entry("vmsplice");
+entry("pipestat");
+entry("sendfile");
+entry("poll");
+entry("uringenter");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("syscount");